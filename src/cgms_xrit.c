@@ -3,10 +3,54 @@
 #include <string.h>
 #include <stdint.h>
 #include <endian.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "memcpy_endian.h"
+#include "tarutils.h"
 #include "cgms_xrit.h"
 
+/* index of the most recently used tar archive */
+static struct tar_index *tar_cache = NULL;
+static pthread_mutex_t tar_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* locate a tar archive member, returning the archive offset and size */
+static int tar_locate( char *file, char *tarfile, off_t *off, size_t *size )
+{
+	const char *member;
+	struct tar_member *m = NULL;
+	struct stat st;
+
+	if( tar_split_path(file, tarfile, PATH_MAX, &member)<0 ) return -1;
+	if( stat(tarfile, &st)<0 ) return -1;
+
+	pthread_mutex_lock( &tar_cache_lock );
+	/* re-index an archive which has been replaced or extended */
+	if( tar_cache!=NULL && ( strcmp(tar_cache->file, tarfile)!=0
+				 || tar_cache->size!=st.st_size
+				 || tar_cache->mtime!=st.st_mtime ) ) {
+		tar_index_free( tar_cache );
+		tar_cache = NULL;
+	}
+	if( tar_cache==NULL ) {
+		tar_cache = tar_index_open( tarfile );
+	}
+	if( tar_cache!=NULL ) {
+		m = tar_index_find( tar_cache, member );
+		if( m ) {
+			*off  = m->offset;
+			*size = m->size;
+		}
+	}
+	pthread_mutex_unlock( &tar_cache_lock );
+	return (m==NULL) ? -1 : 0;
+}
+
 /**
  * \brief  Close a XRIT file
  *
@@ -45,6 +89,113 @@ err_out:
 	return NULL;
 }
 
+/**
+ * \brief  Open a XRIT file as a read-only memory mapping
+ *
+ * The header and data field of a mapped file can be accessed without
+ * copying through xrit_get_header() and xrit_get_data().
+ *
+ * Members of uncompressed tar archives can be opened with a path of the
+ * form "archive.tar/member", in which case the byte range of the member
+ * is mapped from the archive.
+ *
+ * \param[in]  file    the filename
+ *
+ * \return     a pointer to the XRIT file descriptor, or NULL on error
+ */
+struct xrit_file *xrit_mopen( char *file )
+{
+	int fd = -1;
+	struct stat st;
+	struct xrit_file *xf;
+	char   tarfile[PATH_MAX];
+	off_t  off = 0;
+	size_t len;
+	long   pgsz;
+
+	xf = calloc( 1, sizeof(*xf) );
+	if( xf==NULL ) goto err_out;
+
+	fd = open( file, O_RDONLY );
+	if( fd>=0 ) {
+		if( fstat(fd, &st)<0 ) goto err_out;
+		len = st.st_size;
+	} else if( errno==ENOTDIR ) {
+		/* member of a tar archive */
+		if( tar_locate(file, tarfile, &off, &len)<0 ) goto err_out;
+		fd = open( tarfile, O_RDONLY );
+		if( fd<0 ) goto err_out;
+		/* mapping pages beyond the end of a truncated archive would
+		   raise SIGBUS on access */
+		if( fstat(fd, &st)<0 || off+len>st.st_size ) goto err_out;
+	} else {
+		goto err_out;
+	}
+	if( len<16 ) goto err_out;
+
+	/* mmap requires a page aligned file offset */
+	pgsz = sysconf( _SC_PAGESIZE );
+	xf->map_off = off % pgsz;
+	xf->map_len = len;
+	xf->map = mmap( NULL, xf->map_len+xf->map_off, PROT_READ, MAP_PRIVATE,
+			fd, off-xf->map_off );
+	if( xf->map==MAP_FAILED ) {
+		xf->map = NULL;
+		goto err_out;
+	}
+	xf->map += xf->map_off;
+	close( fd );
+
+	xf->ftype      = xf->map[3];
+	memcpy_be32toh( &xf->header_len, xf->map+4, 1 );
+	memcpy_be64toh( &xf->data_len, xf->map+8, 1 );
+	if( xf->header_len>xf->map_len ) goto err_out;
+
+	return xf;
+
+err_out:
+	if( fd>=0 ) close( fd );
+	if( xf && xf->map ) munmap( xf->map-xf->map_off, xf->map_len+xf->map_off );
+	free( xf );
+	return NULL;
+}
+
+/**
+ * \brief  Open a XRIT file held in memory
+ *
+ * The returned descriptor behaves like a memory mapped file, i.e. the
+ * header and data can be accessed by xrit_get_header() and xrit_get_data().
+ * The buffer is not copied, it must stay valid and unmodified until the
+ * file is closed, and is not freed by xrit_fclose().
+ *
+ * \param[in]  buf     the XRIT file contents
+ * \param[in]  len     the length of the buffer
+ *
+ * \return     a pointer to the XRIT file descriptor, or NULL on error
+ */
+struct xrit_file *xrit_open_mem( const void *buf, size_t len )
+{
+	struct xrit_file *xf;
+
+	if( buf==NULL || len<16 ) return NULL;
+
+	xf = calloc( 1, sizeof(*xf) );
+	if( xf==NULL ) return NULL;
+
+	xf->is_mem  = 1;
+	xf->map     = (uint8_t *) buf;
+	xf->map_len = len;
+
+	xf->ftype      = xf->map[3];
+	memcpy_be32toh( &xf->header_len, xf->map+4, 1 );
+	memcpy_be64toh( &xf->data_len, xf->map+8, 1 );
+	if( xf->header_len>xf->map_len ) {
+		free( xf );
+		return NULL;
+	}
+	return xf;
+}
+
 /**
  * \brief  Close a XRIT file
  *
@@ -54,9 +205,16 @@ err_out:
  */
 int xrit_fclose( struct xrit_file *xf )
 {
-	int r;
+	int r = 0;
 
-	r = fclose( xf->fp ) ;
+	if( xf->is_mem ) {
+		/* buffer is owned by the caller */
+	} else if( xf->map ) {
+		if( munmap( xf->map-xf->map_off, xf->map_len+xf->map_off )<0 )
+			r = EOF;
+	} else {
+		r = fclose( xf->fp ) ;
+	}
 	free( xf );
 	return r;
 }
@@ -76,6 +234,10 @@ void *xrit_read_header( struct xrit_file *xf)
 	hdr  = calloc( 1, xf->header_len );
 	if(hdr==NULL) goto err_out;
 
+	if( xf->map ) {
+		memcpy( hdr, xf->map, xf->header_len );
+		return hdr;
+	}
 	fseek( xf->fp, 0, SEEK_SET );
 	r = fread( hdr, xf->header_len, 1, xf->fp );
 	if(r<1) goto err_out;
@@ -103,6 +265,11 @@ void *xrit_read_data( struct xrit_file *xf)
 	data  = calloc( 1, nbyte );
 	if(data==NULL) goto err_out;
 
+	if( xf->map ) {
+		if( xf->header_len+nbyte>xf->map_len ) goto err_out;
+		memcpy( data, xf->map+xf->header_len, nbyte );
+		return data;
+	}
 	fseek( xf->fp, xf->header_len, SEEK_SET );
 	r = fread( data, nbyte, 1, xf->fp );
 	if(r<1) goto err_out;
@@ -114,6 +281,62 @@ err_out:
 	return NULL;
 }
 
+/**
+ * \brief  Read part of the XRIT data
+ *
+ * Files opened by xrit_fopen() are read by pread(), without changing the
+ * file position, mapped files are copied from the mapping.
+ *
+ * \param[in]  xf     a XRIT file
+ * \param[out] buf    the destination buffer
+ * \param[in]  len    the number of bytes to read
+ * \param[in]  off    the offset from the start of the data field
+ *
+ * \return     0 on success, or -1 on failure
+ */
+int xrit_pread_data( struct xrit_file *xf, void *buf, size_t len, size_t off )
+{
+	ssize_t r;
+
+	if( xf->map ) {
+		if( xf->header_len+off+len>xf->map_len ) return -1;
+		memcpy( buf, xf->map+xf->header_len+off, len );
+		return 0;
+	}
+	r = pread( fileno(xf->fp), buf, len, xf->header_len+off );
+	return (r==len) ? 0 : -1;
+}
+
+/**
+ * \brief  Get the XRIT header of a memory mapped file
+ *
+ * \param[in]  xf     a XRIT file opened by xrit_mopen()
+ *
+ * \return     a pointer to the header within the mapping, or NULL if the file
+ *             is not mapped. The header must not be modified or freed.
+ */
+void *xrit_get_header( struct xrit_file *xf )
+{
+	if( xf->map==NULL ) return NULL;
+	return xf->map;
+}
+
+/**
+ * \brief  Get the XRIT data of a memory mapped file
+ *
+ * \param[in]  xf     a XRIT file opened by xrit_mopen()
+ *
+ * \return     a pointer to the data within the mapping, or NULL if the file
+ *             is not mapped or truncated. The data must not be modified or
+ *             freed.
+ */
+void *xrit_get_data( struct xrit_file *xf )
+{
+	if( xf->map==NULL ) return NULL;
+	if( xf->header_len+(xf->data_len+7)/8>xf->map_len ) return NULL;
+	return xf->map+xf->header_len;
+}
+
 /**
  * \brief  Locate a XRIT header record
  *
@@ -142,52 +365,48 @@ void *xrit_find_hrec( void *hdr, size_t len, int hrec_type )
 }
 
 /**
- * \brief  Decode a XRIT header record
+ * \brief  Unpack a XRIT header record into a caller-provided structure
  *
- * \param[in]  hdr        a pointer to the header
- * \param[in]  len        the length of the header
- * \param[in]  hrec_type  the header type
+ * \param[in]  hrec       a pointer to the header record
+ * \param[out] dest       the structure matching the header record type,
+ *                        i.e. struct xrit_hrec_primary for a primary
+ *                        header record
  *
- * \return     an malloc'ed buffer containing the header record, or NULL
- *             on failure/if not found
+ * \return     0 on success, or -1 if the header record type is unknown
  */
-void *xrit_decode_hrec( void *hrec )
+int xrit_unpack_hrec( void *hrec, void *dest )
 {
 	uint8_t  hrec_type;
 	uint16_t hrec_len;
 
-
 	memcpy(&hrec_type, hrec, 1);
 	memcpy_be16toh(&hrec_len, hrec+1, 1);
 
 	switch (hrec_type) {
 	case XRIT_HREC_PRIMARY: {
-		struct xrit_hrec_primary *pri;
+		struct xrit_hrec_primary *pri = dest;
 
-		pri = calloc(1,sizeof(struct xrit_hrec_primary));
 		pri->hrec_type = hrec_type;
 		pri->hrec_len = hrec_len;
 		memcpy(&pri->file_type, hrec+3, 1);
 		memcpy_be32toh(&pri->header_len, hrec+4, 1);
 		memcpy_be64toh(&pri->data_len, hrec+8, 1);
-		return pri;
+		return 0;
 	}
 	case XRIT_HREC_IMAGE_STRUCTURE: {
-		struct xrit_hrec_image_structure *is;
+		struct xrit_hrec_image_structure *is = dest;
 
-		is = calloc(1,sizeof(struct xrit_hrec_image_structure));
 		is->hrec_type = hrec_type;
 		is->hrec_len = hrec_len;
 		memcpy(&is->bpp, hrec+3, 1);
 		memcpy_be16toh(&is->ncol, hrec+4, 1);
 		memcpy_be16toh(&is->nlin, hrec+6, 1);
 		memcpy(&is->compression, hrec+8, 1);
-		return is;
+		return 0;
 	}
 	case XRIT_HREC_IMAGE_NAVIGATION: {
-		struct xrit_hrec_image_navigation *in;
+		struct xrit_hrec_image_navigation *in = dest;
 
-		in = calloc(1,sizeof(struct xrit_hrec_image_navigation));
 		in->hrec_type = hrec_type;
 		in->hrec_len  = hrec_len;
 		memcpy(&in->projection, hrec+3, 32);
@@ -195,9 +414,242 @@ void *xrit_decode_hrec( void *hrec )
 		memcpy_be32toh(&in->lfac,  hrec+39, 1);
 		memcpy_be32toh(&in->coff, hrec+43, 1);
 		memcpy_be32toh(&in->loff, hrec+47, 1);
-		return in;
+		return 0;
+	}
+	default:
+		return -1;
 	}
+}
+
+/**
+ * \brief  Decode a XRIT header record
+ *
+ * \param[in]  hrec       a pointer to the header record
+ *
+ * \return     an malloc'ed buffer containing the header record, or NULL
+ *             on failure/if not found
+ */
+void *xrit_decode_hrec( void *hrec )
+{
+	uint8_t  hrec_type;
+	size_t   size;
+	void    *dest;
+
+	memcpy(&hrec_type, hrec, 1);
+
+	switch (hrec_type) {
+	case XRIT_HREC_PRIMARY:
+		size = sizeof(struct xrit_hrec_primary);
+		break;
+	case XRIT_HREC_IMAGE_STRUCTURE:
+		size = sizeof(struct xrit_hrec_image_structure);
+		break;
+	case XRIT_HREC_IMAGE_NAVIGATION:
+		size = sizeof(struct xrit_hrec_image_navigation);
+		break;
 	default:
 		return NULL;
 	}
+
+	dest = calloc(1,size);
+	if(dest==NULL) return NULL;
+	xrit_unpack_hrec(hrec, dest);
+	return dest;
+}
+
+/* state of a batch read */
+struct xrit_batch {
+	int n;
+	int next;
+	int nthreads;
+	int window;
+	int consumed;
+	int cancel;
+	struct xrit_file **xf;
+	int *status;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t  done;
+	pthread_cond_t  space;
+};
+
+/* read the data field of a XRIT file into the page cache */
+static int batch_read_file( struct xrit_file *xf )
+{
+	uint8_t *data, *start;
+	size_t   len, off, pgsz;
+	volatile uint8_t sum = 0;
+
+	/* in-memory files need no reading */
+	if( xf->is_mem ) return 0;
+
+	data = xrit_get_data(xf);
+	if( data==NULL ) {
+		/* stdio files are only hinted to the kernel */
+		if( xf->fp==NULL ) return -1;
+		posix_fadvise( fileno(xf->fp), xf->header_len, (xf->data_len+7)/8,
+			       POSIX_FADV_WILLNEED );
+		return 0;
+	}
+
+	/* madvise requires a page aligned start address */
+	pgsz  = sysconf(_SC_PAGESIZE);
+	start = (uint8_t *)((uintptr_t)data & ~(pgsz-1));
+	len   = (xf->data_len+7)/8 + (data-start);
+
+#ifdef MADV_POPULATE_READ
+	if( madvise(start, len, MADV_POPULATE_READ)==0 ) return 0;
+#endif
+	/* fall back to faulting in the pages one by one */
+	madvise( start, len, MADV_WILLNEED );
+	for( off=0; off<len; off+=pgsz ) sum += start[off];
+	return 0;
+}
+
+static void *batch_worker( void *arg )
+{
+	struct xrit_batch *b = arg;
+	int i, r;
+
+	for(;;) {
+		/* wait until the next file is within the read-ahead window */
+		pthread_mutex_lock( &b->lock );
+		while( !b->cancel && b->next<b->n && b->next>=b->consumed+b->window )
+			pthread_cond_wait( &b->space, &b->lock );
+		i = b->cancel ? b->n : b->next++;
+		pthread_mutex_unlock( &b->lock );
+		if( i>=b->n ) break;
+
+		r = batch_read_file( b->xf[i] );
+
+		pthread_mutex_lock( &b->lock );
+		b->status[i] = (r<0) ? -1 : 1;
+		pthread_cond_broadcast( &b->done );
+		pthread_mutex_unlock( &b->lock );
+	}
+	return NULL;
+}
+
+/**
+ * \brief  Start reading the data fields of several XRIT files at once
+ *
+ * The data of all files is read concurrently by a pool of reader threads,
+ * so that the I/O latency of the individual files overlaps. For memory
+ * mapped files, the data is read into the mapping, i.e. the page cache,
+ * and can be accessed through xrit_get_data() without further I/O once
+ * the file has completed. Files are read roughly in the order given.
+ *
+ * At most window files are read ahead of the file last waited for by
+ * xrit_batch_wait(), so that files are consumed, e.g. decompressed, while
+ * the following ones are read, without holding the whole batch in memory.
+ * A window of 2 gives classical double buffering.
+ *
+ * \param[in]  n         the number of files
+ * \param[in]  xf        the XRIT files, which must stay open until the
+ *                       batch is freed
+ * \param[in]  nthreads  the number of reader threads, or 0 for the default
+ * \param[in]  window    the number of files in flight, or 0 for no limit
+ *
+ * \return     the batch, or NULL on failure
+ */
+struct xrit_batch *xrit_batch_read( int n, struct xrit_file **xf, int nthreads,
+				    int window )
+{
+	int i;
+	struct xrit_batch *b;
+
+	b = calloc( 1, sizeof(*b) );
+	if( b==NULL ) goto err_out;
+
+	if( nthreads<=0 ) nthreads = XRIT_BATCH_NTHREADS;
+	if( window<=0 ) window = n;
+	if( nthreads>window ) nthreads = window;
+	if( nthreads>n ) nthreads = n;
+
+	b->n  = n;
+	b->xf = xf;
+	b->window = window;
+	b->status  = calloc( n>0 ? n : 1, sizeof(int) );
+	b->threads = calloc( nthreads>0 ? nthreads : 1, sizeof(pthread_t) );
+	if( b->status==NULL || b->threads==NULL ) goto err_out;
+	pthread_mutex_init( &b->lock, NULL );
+	pthread_cond_init( &b->done, NULL );
+	pthread_cond_init( &b->space, NULL );
+
+	for( i=0; i<nthreads; i++ ) {
+		if( pthread_create( b->threads+i, NULL, batch_worker, b )!=0 ) break;
+	}
+	b->nthreads = i;
+
+	return b;
+
+err_out:
+	if( b ) {
+		free( b->status );
+		free( b->threads );
+	}
+	free( b );
+	return NULL;
+}
+
+/**
+ * \brief  Wait until a file of a batch read has completed
+ *
+ * Waiting for a file also signals that the files before it have been
+ * consumed, which advances the read-ahead window.
+ *
+ * \param[in]  b      the batch
+ * \param[in]  i      the index of the file in the batch
+ *
+ * \return     0 on success, or -1 if reading the file failed
+ */
+int xrit_batch_wait( struct xrit_batch *b, int i )
+{
+	int r;
+
+	/* read synchronously if no thread could be started */
+	if( b->nthreads==0 && b->status[i]==0 ) {
+		b->status[i] = (batch_read_file(b->xf[i])<0) ? -1 : 1;
+	}
+
+	pthread_mutex_lock( &b->lock );
+	if( i>b->consumed ) {
+		b->consumed = i;
+		pthread_cond_broadcast( &b->space );
+	}
+	while( b->status[i]==0 ) pthread_cond_wait( &b->done, &b->lock );
+	r = (b->status[i]<0) ? -1 : 0;
+	pthread_mutex_unlock( &b->lock );
+	return r;
+}
+
+/**
+ * \brief  Free a batch read, waiting for outstanding reads to complete
+ *
+ * Files of the batch not yet started are no longer read.
+ *
+ * \param[in]  b      the batch, may be NULL
+ *
+ * \return     nothing
+ */
+void xrit_batch_free( struct xrit_batch *b )
+{
+	int i;
+
+	if( b ) {
+		/* stop reading files not yet started */
+		pthread_mutex_lock( &b->lock );
+		b->cancel = 1;
+		pthread_cond_broadcast( &b->space );
+		pthread_mutex_unlock( &b->lock );
+
+		for( i=0; i<b->nthreads; i++ ) pthread_join( b->threads[i], NULL );
+		pthread_mutex_destroy( &b->lock );
+		pthread_cond_destroy( &b->done );
+		pthread_cond_destroy( &b->space );
+		free( b->status );
+		free( b->threads );
+		free( b );
+	}
+	return;
 }
@@ -16,6 +16,12 @@ struct xrit_file {
 	uint8_t  ftype;
 	uint32_t header_len;
 	uint64_t data_len;
+	uint8_t  *map;      /* read-only mapping of the file, or NULL */
+	size_t   map_len;
+	size_t   map_off;   /* offset of map from the start of the mapping,
+	                       non-zero for members of tar archives */
+	int      is_mem;    /* map is a caller supplied buffer, see
+	                       xrit_open_mem() */
 };
 
 /* definition of XRIT header record types */
@@ -55,13 +61,30 @@ struct xrit_hrec_image_navigation {
 	uint32_t loff;
 };
 
+/* default number of reader threads of a batch read */
+#define XRIT_BATCH_NTHREADS  8
+/* default number of files in flight of a batch read */
+#define XRIT_BATCH_WINDOW    4
+
+struct xrit_batch;
+
 struct xrit_file *xrit_fopen(char *file, char *mode);
+struct xrit_file *xrit_mopen(char *file);
+struct xrit_file *xrit_open_mem(const void *buf, size_t len);
 int xrit_fclose(struct xrit_file *xf);
 
 void *xrit_read_header(struct xrit_file *xf);
 void *xrit_read_data(struct xrit_file *xf);
+int xrit_pread_data(struct xrit_file *xf, void *buf, size_t len, size_t off);
+void *xrit_get_header(struct xrit_file *xf);
+void *xrit_get_data(struct xrit_file *xf);
 void *xrit_find_hrec(void *hdr, size_t len, int hrec_type);
 void *xrit_decode_hrec(void *hdr);
+int xrit_unpack_hrec(void *hrec, void *dest);
+
+struct xrit_batch *xrit_batch_read(int n, struct xrit_file **xf, int nthreads, int window);
+int xrit_batch_wait(struct xrit_batch *b, int i);
+void xrit_batch_free(struct xrit_batch *b);
 
 #ifdef __cplusplus
 }
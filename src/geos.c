@@ -93,6 +93,17 @@ err_out:
 	return NULL;
 }
 
+/**
+ * \brief free context and parameter info for geostationary sat. projection
+ *
+ * \param[in]  gp    parameter settings returned by geos_init(), or NULL
+ */
+void geos_free( struct geos_param *gp )
+{
+	free(gp);
+	return;
+}
+
 /**
  * \brief get lat/longitude for geostationary satellite projection
  *
@@ -211,3 +222,65 @@ int geos_satpos2d( struct geos_param *gp, float sslon, int nlin, int ncol,
 	}
 	return 0;
 }
+
+/**
+ * \brief get satellite position in cosine zenith and azimuth angle, for
+ *        the true satellite position of each line
+ *
+ * \param[in]  gp     parameter settings
+ * \param[in]  nlin   number of lines
+ * \param[in]  ncol   number of columnes
+ * \param[in]  lat    latitude [in degrees]
+ * \param[in]  lon    longitude [in degrees]
+ * \param[in]  satpos earth-fixed satellite position x, y, z of each line,
+ *                    i.e. 3*nlin values [in km]
+ * \param[out] muS    cosine of zenith angle [-]
+ * \param[out] azS    azimuth angle [in degrees]
+ */
+int geos_satpos2d_ecef( struct geos_param *gp, int nlin, int ncol,
+			float *lat, float *lon, const double *satpos,
+			float *muS, float *azS )
+{
+	int i, l, c;
+	double sin_lat, cos_lat, sin_lon, cos_lon;
+	double clat, sin_clat, cos_clat, re;
+	double dx, dy, dz, dist, de, dn, du;
+	const double *s;
+	float nan=nanf("");
+
+	for( l=0; l<nlin; l++ ) {
+		s = satpos+3*l;
+		for( c=0; c<ncol; c++ ) {
+			i = l*ncol+c;
+
+			/* test if we have valid input data */
+			if( isnan(lat[i]) || isnan(lon[i]) || isnan(s[0]) ) {
+				muS[i] = nan;
+				azS[i] = nan;
+				continue;
+			}
+			sincos( DEG2RAD(lat[i]), &sin_lat, &cos_lat );
+			sincos( DEG2RAD(lon[i]), &sin_lon, &cos_lon );
+
+			/* vector from the obs. point on the ellipsoid to the
+			   satellite */
+			clat = atan( SQR(gp->b/gp->a)*sin_lat/cos_lat );
+			sincos( clat, &sin_clat, &cos_clat );
+			re = gp->b/sqrt(1.0-gp->c2*SQR(cos_clat));
+			dx = s[0] - re*cos_clat*cos_lon;
+			dy = s[1] - re*cos_clat*sin_lon;
+			dz = s[2] - re*sin_clat;
+			dist = sqrt( SQR(dx)+SQR(dy)+SQR(dz) );
+
+			/* local east/north/up components */
+			de = -sin_lon*dx + cos_lon*dy;
+			dn = -sin_lat*cos_lon*dx - sin_lat*sin_lon*dy + cos_lat*dz;
+			du =  cos_lat*cos_lon*dx + cos_lat*sin_lon*dy + sin_lat*dz;
+
+			muS[i] = du/dist;
+			azS[i] = RAD2DEG(atan2(de,dn));
+			azS[i] = (azS[i]>=0.0)? azS[i] : azS[i]+360.0;
+		}
+	}
+	return 0;
+}
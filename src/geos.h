@@ -40,6 +40,9 @@ int geos_latlon2d( struct geos_param *gp, float sslon, int nlin, int ncol,
 		   float *lat, float *lon );
 int geos_satpos2d( struct geos_param *gp, float sslon, int nlin, int ncol,
 		   float *lat, float *lon, float *muS, float *azS );
+int geos_satpos2d_ecef( struct geos_param *gp, int nlin, int ncol,
+			float *lat, float *lon, const double *satpos,
+			float *muS, float *azS );
 /***** end function prototypes ***********************************************/
 
 #endif /* _GEOS_H_ */
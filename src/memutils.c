@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "memutils.h"
 
 
@@ -152,34 +155,586 @@ void free_ptr_array(size_t n, void **ptr_arr)
 }
 
 
+/* unpack the 10bit element at offset off */
+static inline uint16_t unpack_10bit_one (const uint8_t *s, size_t off)
+{
+	const uint8_t *p = s+off/4*5+off%4;
+	uint8_t shift = 6-2*(off%4);
+
+	return ((((uint16_t)p[0]<<8) | p[1]) >> shift) & 0x3FF;
+}
+
+/* unpack a group of 4 10bit elements stored in 5 bytes */
+static inline void unpack_10bit_group (const uint8_t *s, uint16_t *d)
+{
+	d[0] =  ((uint16_t)s[0]<<2)         | (s[1]>>6);
+	d[1] = (((uint16_t)s[1]&0x3F)<<4)   | (s[2]>>4);
+	d[2] = (((uint16_t)s[2]&0x0F)<<6)   | (s[3]>>2);
+	d[3] = (((uint16_t)s[3]&0x03)<<8)   |  s[4];
+	return;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * SIMD kernels unpacking ngroup groups of 4 elements. The two 16bit words
+ * containing an element are gathered into one 16bit lane by a byte
+ * shuffle, the element is moved to the top of the lane by a multiplication
+ * with 1, 4, 16 or 64, and then shifted down by 6 bits. For reverse
+ * unpacking, d points to the end of the destination. The kernels return
+ * the number of groups unpacked, the rest is left to the caller, as the
+ * loads read up to 6 bytes beyond the groups unpacked.
+ */
+__attribute__((target("ssse3")))
+static size_t unpack_10bit_ssse3 (const uint8_t *s, uint16_t *d, size_t ngroup, int rev)
+{
+	const __m128i shuf = _mm_setr_epi8( 1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8 );
+	const __m128i revm = _mm_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+	const __m128i mul  = _mm_setr_epi16( 1, 4, 16, 64, 1, 4, 16, 64 );
+	__m128i v;
+	size_t g;
+
+	for (g=0; g+4<=ngroup; g+=2) {
+		v = _mm_loadu_si128( (const __m128i *)(s+g*5) );
+		v = _mm_shuffle_epi8( v, shuf );
+		v = _mm_srli_epi16( _mm_mullo_epi16( v, mul ), 6 );
+		if (rev) {
+			v = _mm_shuffle_epi8( v, revm );
+			_mm_storeu_si128( (__m128i *)(d-(g+2)*4), v );
+		} else {
+			_mm_storeu_si128( (__m128i *)(d+g*4), v );
+		}
+	}
+	return g;
+}
+
+__attribute__((target("avx2")))
+static size_t unpack_10bit_avx2 (const uint8_t *s, uint16_t *d, size_t ngroup, int rev)
+{
+	const __m256i shuf = _mm256_setr_epi8( 1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8,
+					       1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8 );
+	const __m256i revm = _mm256_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+					       14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+	const __m256i mul  = _mm256_setr_epi16( 1, 4, 16, 64, 1, 4, 16, 64,
+						1, 4, 16, 64, 1, 4, 16, 64 );
+	__m256i v;
+	size_t g;
+
+	for (g=0; g+6<=ngroup; g+=4) {
+		v = _mm256_castsi128_si256( _mm_loadu_si128( (const __m128i *)(s+g*5) ) );
+		v = _mm256_inserti128_si256( v, _mm_loadu_si128( (const __m128i *)(s+g*5+10) ), 1 );
+		v = _mm256_shuffle_epi8( v, shuf );
+		v = _mm256_srli_epi16( _mm256_mullo_epi16( v, mul ), 6 );
+		if (rev) {
+			v = _mm256_shuffle_epi8( v, revm );
+			v = _mm256_permute4x64_epi64( v, 0x4E );
+			_mm256_storeu_si256( (__m256i *)(d-(g+4)*4), v );
+		} else {
+			_mm256_storeu_si256( (__m256i *)(d+g*4), v );
+		}
+	}
+	return g;
+}
+
+static size_t unpack_10bit_simd (const uint8_t *s, uint16_t *d, size_t ngroup, int rev)
+{
+	size_t g = 0;
+
+	if (__builtin_cpu_supports("avx2")) {
+		g = unpack_10bit_avx2( s, d, ngroup, rev );
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		g += unpack_10bit_ssse3( s+g*5, rev ? d-g*4 : d+g*4, ngroup-g, rev );
+	}
+	return g;
+}
+#else
+static size_t unpack_10bit_simd (const uint8_t *s, uint16_t *d, size_t ngroup, int rev)
+{
+	return 0;
+}
+#endif
+
 /**
  * \brief    unpack 10bit data elements to 16bit values
  *
+ * Groups of 4 elements are unpacked using SSSE3 or AVX2 instructions if
+ * supported by the CPU, an unaligned head and the tail are unpacked
+ * element by element.
+ *
  * \param[in]   src   the input buffer containing 10bit data
  * \param[out]  dest  the output buffer to containt the 16bit data
  * \param[in]   off   start offset in number of 10bit elements
  * \param[in]   cnt   the number of data elements to unpack
  *
- * \return          0 on success or -1 on failure
+ * \return          nothing
  *
  * \author          Hartwig Deneke
  */
 void unpack_10bit_to_16bit (void *src, uint16_t *dest, size_t off, size_t cnt)
 {
-	int i, r, soff;
-	int loff[]        = {     0,      1,       2,     3};
-	uint16_t lmask[]  = {0xFFC0, 0x3FF0, 0x0FFC, 0x03FF};
-	uint8_t  lshift[] = {     6,      4,      2,      0};
-	uint8_t *s=src;
-
-	for (i=0; i<cnt; i++){
-		/* remainder of div 4 is used as index to lookup tables
-		   for offset/mask/shift */
-		r = (off+i) % 4;
-		soff = (off+i)/4*5+loff[r];
-		dest[i] = ((uint16_t)s[soff]<<8) + s[soff+1];
-		dest[i] &= lmask[r];
-		dest[i] >>= lshift[r];
- 	}
+	size_t g, ngroup;
+	const uint8_t *s=src;
+
+	/* unaligned head */
+	for (; cnt>0 && off%4!=0; cnt--, off++) *dest++ = unpack_10bit_one( s, off );
+
+	/* groups of 4 elements */
+	s += off/4*5;
+	ngroup = cnt/4;
+	g = unpack_10bit_simd( s, dest, ngroup, 0 );
+	for (; g<ngroup; g++) unpack_10bit_group( s+g*5, dest+g*4 );
+
+	/* tail */
+	for (g=ngroup*4; g<cnt; g++) dest[g] = unpack_10bit_one( s, g );
+	return;
+}
+
+/**
+ * \brief    unpack 10bit data elements to 16bit values in reverse order
+ *
+ * \param[in]   src   the input buffer containing 10bit data
+ * \param[out]  dest  the output buffer to containt the 16bit data, the
+ *                    element at offset off is written to dest[cnt-1]
+ * \param[in]   off   start offset in number of 10bit elements
+ * \param[in]   cnt   the number of data elements to unpack
+ *
+ * \return          nothing
+ */
+void unpack_10bit_to_16bit_rev (void *src, uint16_t *dest, size_t off, size_t cnt)
+{
+	size_t g, ngroup;
+	uint16_t v[4], *d = dest+cnt;
+	const uint8_t *s=src;
+
+	/* unaligned head */
+	for (; cnt>0 && off%4!=0; cnt--, off++) *--d = unpack_10bit_one( s, off );
+
+	/* groups of 4 elements */
+	s += off/4*5;
+	ngroup = cnt/4;
+	g = unpack_10bit_simd( s, d, ngroup, 1 );
+	for (; g<ngroup; g++) {
+		unpack_10bit_group( s+g*5, v );
+		d[-g*4-1] = v[0];
+		d[-g*4-2] = v[1];
+		d[-g*4-3] = v[2];
+		d[-g*4-4] = v[3];
+	}
+
+	/* tail */
+	for (g=ngroup*4; g<cnt; g++) d[-g-1] = unpack_10bit_one( s, g );
+	return;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * SIMD kernels reversing blocks of 8 (SSSE3) or 16 (AVX2) elements, s
+ * points to the end of the source. The destination is expected to be
+ * aligned to the vector size. The kernels return the number of elements
+ * copied.
+ */
+__attribute__((target("ssse3")))
+static size_t memcpy_rev16_ssse3 (uint16_t *d, const uint16_t *s, size_t n)
+{
+	const __m128i revm = _mm_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+	__m128i v;
+	size_t i;
+
+	for (i=0; i+8<=n; i+=8) {
+		v = _mm_loadu_si128( (const __m128i *)(s-i-8) );
+		_mm_store_si128( (__m128i *)(d+i), _mm_shuffle_epi8( v, revm ) );
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t memcpy_rev16_avx2 (uint16_t *d, const uint16_t *s, size_t n)
+{
+	const __m256i revm = _mm256_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+					       14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+	__m256i v;
+	size_t i;
+
+	for (i=0; i+16<=n; i+=16) {
+		v = _mm256_loadu_si256( (const __m256i *)(s-i-16) );
+		v = _mm256_permute4x64_epi64( _mm256_shuffle_epi8( v, revm ), 0x4E );
+		_mm256_store_si256( (__m256i *)(d+i), v );
+	}
+	return i;
+}
+#endif
+
+/**
+ * \brief    copy 16bit elements in reverse order
+ *
+ * The elements are reversed using SSSE3 or AVX2 byte shuffles if supported
+ * by the CPU. The head is copied element by element until the destination
+ * is aligned to the vector size, the tail not filling a full vector is
+ * copied element by element as well.
+ *
+ * \param[out]  dest  the destination buffer, dest[i] is set to src[cnt-1-i]
+ * \param[in]   src   the source buffer
+ * \param[in]   cnt   the number of elements to copy
+ *
+ * \return          nothing
+ */
+void memcpy_rev16 (uint16_t *dest, const uint16_t *src, size_t cnt)
+{
+	size_t i = 0;
+	const uint16_t *s = src+cnt;
+
+#if defined(__x86_64__) || defined(__i386__)
+	size_t align = 0;
+
+	if (__builtin_cpu_supports("avx2")) {
+		align = 32;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		align = 16;
+	}
+	if (align>0 && ((uintptr_t)dest)%2==0) {
+		/* unaligned head */
+		for (; i<cnt && ((uintptr_t)(dest+i))%align!=0; i++) dest[i] = s[-i-1];
+		if (align==32) {
+			i += memcpy_rev16_avx2( dest+i, s-i, cnt-i );
+		}
+		i += memcpy_rev16_ssse3( dest+i, s-i, cnt-i );
+	}
+#endif
+	/* tail */
+	for (; i<cnt; i++) dest[i] = s[-i-1];
+	return;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * AVX2 kernel looking up 8 table entries per iteration by a gather. The
+ * kernel returns the number of elements looked up.
+ */
+__attribute__((target("avx2")))
+static size_t lut_gather_f32_avx2 (float *d, const float *lut, const uint16_t *idx,
+				   size_t n, uint16_t mask)
+{
+	const __m256i m = _mm256_set1_epi32( mask );
+	__m256i v;
+	size_t i;
+
+	for (i=0; i+8<=n; i+=8) {
+		v = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(idx+i) ) );
+		v = _mm256_and_si256( v, m );
+		_mm256_storeu_ps( d+i, _mm256_i32gather_ps( lut, v, 4 ) );
+	}
+	return i;
+}
+#endif
+
+/**
+ * \brief    look up 16bit indices in a table of floats
+ *
+ * The indices are masked, i.e. the table needs mask+1 entries, with mask+1
+ * a power of two. The lookups use AVX2 gathers if supported by the CPU.
+ *
+ * \param[out]  dest  the destination buffer, dest[i] is set to
+ *                    lut[idx[i]&mask]
+ * \param[in]   lut   the table
+ * \param[in]   idx   the indices, e.g. 10bit counts
+ * \param[in]   cnt   the number of elements to look up
+ * \param[in]   mask  the mask applied to the indices
+ *
+ * \return          nothing
+ */
+void lut_gather_f32 (float *dest, const float *lut, const uint16_t *idx, size_t cnt,
+		     uint16_t mask)
+{
+	size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		i = lut_gather_f32_avx2( dest, lut, idx, cnt, mask );
+	}
+#endif
+	for (; i<cnt; i++) dest[i] = lut[idx[i]&mask];
+	return;
+}
+
+/*
+ * Arena allocator for transient allocations, which are released all at
+ * once by mem_arena_reset(). The blocks of an arena are merged into one
+ * block on reset, so that an arena reaches a steady state without further
+ * heap allocations after the first cycle of a batch or daemon run.
+ */
+struct mem_arena_block {
+	struct mem_arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+struct mem_arena {
+	struct mem_arena_block *blk;
+	size_t block_size;
+};
+
+#define ARENA_ALIGN  16
+#define ARENA_HDR    ((sizeof(struct mem_arena_block)+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1))
+
+static struct mem_arena_block *arena_block_alloc (size_t size)
+{
+	struct mem_arena_block *b;
+
+	b = malloc(ARENA_HDR+size);
+	if (b==NULL) return NULL;
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+/**
+ * \brief    create an arena
+ *
+ * \param[in]   block_size  the initial size of the arena in bytes
+ *
+ * \return          the arena, or NULL on error
+ */
+struct mem_arena *mem_arena_create (size_t block_size)
+{
+	struct mem_arena *a;
+
+	a = calloc(1, sizeof(*a));
+	if (a==NULL) return NULL;
+	a->block_size = block_size>0 ? block_size : 65536;
+	return a;
+}
+
+/**
+ * \brief    allocate memory from an arena
+ *
+ * \param[in]   a     the arena
+ * \param[in]   size  the number of bytes to allocate
+ *
+ * \return          the memory, aligned to 16 bytes, or NULL on error
+ */
+void *mem_arena_alloc (struct mem_arena *a, size_t size)
+{
+	struct mem_arena_block *b = a->blk;
+	void *p;
+
+	size = (size+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1);
+	if (b==NULL || b->size-b->used<size) {
+		b = arena_block_alloc(size>a->block_size ? size : a->block_size);
+		if (b==NULL) return NULL;
+		b->next = a->blk;
+		a->blk = b;
+	}
+	p = (char *)b+ARENA_HDR+b->used;
+	b->used += size;
+	return p;
+}
+
+/**
+ * \brief    allocate zero-initialised memory from an arena
+ *
+ * \param[in]   a      the arena
+ * \param[in]   nmemb  the number of elements
+ * \param[in]   size   the size of an element
+ *
+ * \return          the memory, or NULL on error
+ */
+void *mem_arena_calloc (struct mem_arena *a, size_t nmemb, size_t size)
+{
+	void *p;
+
+	p = mem_arena_alloc(a, nmemb*size);
+	if (p) memset(p, 0, nmemb*size);
+	return p;
+}
+
+/**
+ * \brief    release all allocations of an arena
+ *
+ * If the allocations did not fit into a single block, the blocks are
+ * replaced by one block of their total size.
+ *
+ * \param[in]   a     the arena, may be NULL
+ *
+ * \return          nothing
+ */
+void mem_arena_reset (struct mem_arena *a)
+{
+	struct mem_arena_block *b, *next;
+	size_t total = 0;
+
+	if (a==NULL || a->blk==NULL) return;
+	if (a->blk->next!=NULL) {
+		for (b=a->blk; b!=NULL; b=next) {
+			next = b->next;
+			total += b->size;
+			free(b);
+		}
+		a->block_size = total;
+		a->blk = arena_block_alloc(total);
+	}
+	if (a->blk) a->blk->used = 0;
+	return;
+}
+
+/**
+ * \brief    free an arena and all its allocations
+ *
+ * \param[in]   a     the arena, may be NULL
+ *
+ * \return          nothing
+ */
+void mem_arena_destroy (struct mem_arena *a)
+{
+	struct mem_arena_block *b, *next;
+
+	if (a==NULL) return;
+	for (b=a->blk; b!=NULL; b=next) {
+		next = b->next;
+		free(b);
+	}
+	free(a);
+	return;
+}
+
+/*
+ * Pool of large buffers, e.g. image and geometry arrays, which are kept
+ * mapped after being released and handed out again for requests of a
+ * similar size. Buffers are mapped anonymously, from huge pages if
+ * enabled and available, and transparent huge pages otherwise.
+ */
+struct pool_buf {
+	void  *p;
+	size_t size;
+	int    used;
+	struct pool_buf *next;
+};
+
+static struct pool_buf *pool = NULL;
+static int pool_hugepages = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define POOL_PAGE       4096
+#define POOL_HUGEPAGE   (2UL<<20)
+
+/**
+ * \brief    back pool buffers allocated afterwards by huge pages
+ *
+ * \param[in]   enable   non-zero to enable huge pages
+ *
+ * \return          nothing
+ */
+void mem_pool_set_hugepages (int enable)
+{
+	pool_hugepages = enable;
+	return;
+}
+
+/**
+ * \brief    allocate a buffer from the pool
+ *
+ * Released buffers of at least size bytes, and at most twice that size,
+ * are reused. The content of the buffer is undefined. Only requests of
+ * at least one huge page are backed by huge pages, smaller ones would
+ * pin a whole huge page each.
+ *
+ * \param[in]   size  the number of bytes to allocate
+ *
+ * \return          the buffer, aligned to a page, or NULL on error
+ */
+void *mem_pool_alloc (size_t size)
+{
+	struct pool_buf *b, *best = NULL;
+	int    huge = pool_hugepages && size>=POOL_HUGEPAGE;
+	size_t page = huge ? POOL_HUGEPAGE : POOL_PAGE;
+	void *p = MAP_FAILED;
+
+	size = (size+page-1)/page*page;
+	if (size==0) size = page;
+
+	/* reuse the smallest released buffer fitting the request */
+	pthread_mutex_lock(&pool_lock);
+	for (b=pool; b!=NULL; b=b->next) {
+		if (b->used || b->size<size || b->size>2*size) continue;
+		if (best==NULL || b->size<best->size) best = b;
+	}
+	if (best) best->used = 1;
+	pthread_mutex_unlock(&pool_lock);
+	if (best) return best->p;
+
+	b = malloc(sizeof(*b));
+	if (b==NULL) return NULL;
+#ifdef MAP_HUGETLB
+	if (huge) {
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if (p==MAP_FAILED) {
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p==MAP_FAILED) {
+			free(b);
+			return NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		if (huge) madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+	b->p    = p;
+	b->size = size;
+	b->used = 1;
+
+	pthread_mutex_lock(&pool_lock);
+	b->next = pool;
+	pool = b;
+	pthread_mutex_unlock(&pool_lock);
+	return p;
+}
+
+/**
+ * \brief    release a buffer to the pool
+ *
+ * \param[in]   p     the buffer allocated by mem_pool_alloc(), may be NULL
+ *
+ * \return          nothing
+ */
+void mem_pool_free (void *p)
+{
+	struct pool_buf *b;
+
+	if (p==NULL) return;
+	pthread_mutex_lock(&pool_lock);
+	for (b=pool; b!=NULL; b=b->next) {
+		if (b->p==p) {
+			b->used = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return;
+}
+
+/**
+ * \brief    unmap all released buffers of the pool
+ *
+ * \return          nothing
+ */
+void mem_pool_trim (void)
+{
+	struct pool_buf *b, **pb;
+
+	pthread_mutex_lock(&pool_lock);
+	for (pb=&pool; (b=*pb)!=NULL; ) {
+		if (b->used) {
+			pb = &b->next;
+			continue;
+		}
+		munmap(b->p, b->size);
+		*pb = b->next;
+		free(b);
+	}
+	pthread_mutex_unlock(&pool_lock);
 	return;
 }
@@ -28,6 +28,22 @@ void *calloc_ndim(size_t ndim, size_t *dim, size_t size);
 void *deref_ptr(void *p, int n);
 void free_ptr_array(size_t n, void **ptr_arr);
 void unpack_10bit_to_16bit (void *src, uint16_t *dest, size_t off, size_t cnt);
+void unpack_10bit_to_16bit_rev (void *src, uint16_t *dest, size_t off, size_t cnt);
+void memcpy_rev16 (uint16_t *dest, const uint16_t *src, size_t cnt);
+void lut_gather_f32 (float *dest, const float *lut, const uint16_t *idx, size_t cnt,
+		     uint16_t mask);
+
+struct mem_arena;
+struct mem_arena *mem_arena_create (size_t block_size);
+void *mem_arena_alloc (struct mem_arena *a, size_t size);
+void *mem_arena_calloc (struct mem_arena *a, size_t nmemb, size_t size);
+void mem_arena_reset (struct mem_arena *a);
+void mem_arena_destroy (struct mem_arena *a);
+
+void  mem_pool_set_hugepages (int enable);
+void *mem_pool_alloc (size_t size);
+void  mem_pool_free (void *p);
+void  mem_pool_trim (void);
 /***** end function prototypes ***********************************************/
 
 #ifdef __cplusplus
@@ -0,0 +1,197 @@
+/* system includes */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+/* local includes */
+#include "memutils.h"
+#include "cds_time.h"
+#include "cgms_xrit.h"
+#include "msevi_l15data.h"
+#include "msevi_l15hrit.h"
+
+struct prog_opts {
+	int    repeat;
+	int    map;
+} popts= {
+	.repeat   = 10,
+	.map      = 0,
+};
+
+static void print_usage (char *prog_name)
+{
+	printf ( "Usage: %s [OPTS] FILE...\n"
+		 "       %s [OPTS] -m\n"
+		 "Benchmark the decoding of METEOSAT SEVIRI HRIT image segments\n\n"
+		 "For each segment, the mean decoding time and a checksum of the decoded\n"
+		 "counts are printed. The checksums allow to verify that builds linked\n"
+		 "against different wavelet decoders produce identical output.\n\n"
+		 "Options:\n"
+		 "\t-h, --help\t\tshow this help message\n"
+		 "\t-n N, --repeat=N\tdecode each segment N times (default: 10)\n"
+		 "\t-m, --map\t\tbenchmark the reversed copy of segment lines into an\n\t\t\t\timage, for VIS/IR and HRV segment sizes\n",
+		 prog_name, prog_name );
+	return;
+}
+
+static int parse_args (int argc, char **argv)
+{
+	int  optidx = 1;
+	char optstr[] = "hmn:";
+	char c;
+
+	const struct option pargs [] = {
+                 { .name = "help",    .has_arg = 0, .flag = NULL, .val = 'h'},
+                 { .name = "repeat",  .has_arg = 1, .flag = NULL, .val = 'n'},
+                 { .name = "map",     .has_arg = 0, .flag = NULL, .val = 'm'},
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, optstr, pargs, &optidx);
+
+		if (c == -1) break;
+		switch (c) {
+		case 'h':
+			print_usage(argv[0]);
+			exit(0);
+		case 'n':
+			popts.repeat = atoi(optarg);
+			break;
+		case 'm':
+			popts.map = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return ((popts.map || optind<argc) && popts.repeat>0) ? 0 : -1;
+}
+
+static double elapsed( struct timespec *t0, struct timespec *t1 )
+{
+	return (t1->tv_sec-t0->tv_sec) + 1e-9*(t1->tv_nsec-t0->tv_nsec);
+}
+
+/* FNV-1a hash of the decoded counts */
+static uint64_t checksum( uint16_t *counts, size_t n )
+{
+	size_t i;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for( i=0; i<n; i++ ) {
+		h = (h ^ (counts[i] & 0xff)) * 0x100000001b3ULL;
+		h = (h ^ (counts[i] >> 8)) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Copy the lines of a segment reversed into an image with one column
+ * offset, once by the scalar loop and once by memcpy_rev16(), and compare
+ * the throughput and results.
+ */
+static int bench_map( char *name, int nlin, int ncol )
+{
+	int il, ic, k, r = -1;
+	size_t n = (size_t)nlin*ncol;
+	double tscalar = 0.0, tsimd = 0.0;
+	uint16_t *src, *ref, *dest, *csrc, *cdest;
+	struct timespec t0, t1;
+
+	src  = malloc( n*sizeof(*src) );
+	ref  = calloc( n+1, sizeof(*ref) );
+	dest = calloc( n+1, sizeof(*dest) );
+	if( src==NULL || ref==NULL || dest==NULL ) goto err_out;
+	for( ic=0; ic<n; ic++ ) src[ic] = (ic*2654435761u)>>22;
+
+	for( k=0; k<popts.repeat; k++ ) {
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		for( il=0; il<nlin; il++ ) {
+			cdest = ref+1+(size_t)il*ncol;
+			csrc  = src+(size_t)(nlin-il-1)*ncol+ncol-1;
+			for( ic=0; ic<ncol; ic++ ) *cdest++ = *csrc--;
+		}
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		tscalar += elapsed( &t0, &t1 );
+
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		for( il=0; il<nlin; il++ )
+			memcpy_rev16( dest+1+(size_t)il*ncol,
+				      src+(size_t)(nlin-il-1)*ncol, ncol );
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		tsimd += elapsed( &t0, &t1 );
+	}
+	r = memcmp( ref, dest, (n+1)*sizeof(*ref) )==0 ? 0 : -1;
+	printf( "map %s %dx%d: scalar %.3f ms, %.1f MB/s, simd %.3f ms, %.1f MB/s%s\n",
+		name, nlin, ncol, 1e3*tscalar/popts.repeat,
+		2e-6*n*popts.repeat/tscalar, 1e3*tsimd/popts.repeat,
+		2e-6*n*popts.repeat/tsimd, (r==0) ? "" : ", MISMATCH" );
+
+err_out:
+	free( src );
+	free( ref );
+	free( dest );
+	return r;
+}
+
+int main (int argc, char **argv)
+{
+	int i, k, npix;
+	double t, ttot = 0.0, npix_tot = 0.0;
+	uint64_t h;
+	struct timespec t0, t1;
+	struct msevi_l15hrit_segment *seg;
+	struct msevi_l15_image *img;
+
+	/* parse command line arguments */
+	if (parse_args (argc, argv) <0) {
+		print_usage( argv[0] );
+		return -1;
+	}
+
+	if( popts.map ) {
+		if( bench_map( "vis_ir", 464, MSEVI_VISIR_NCOL )<0 ) return -1;
+		if( bench_map( "hrv", 464, MSEVI_HRV_NCOL )<0 ) return -1;
+		return 0;
+	}
+
+	for( i=optind; i<argc; i++ ) {
+		seg = msevi_l15hrit_open_segment( argv[i] );
+		if( seg==NULL ) {
+			fprintf( stderr, "Unable to open segment %s\n", argv[i] );
+			return -1;
+		}
+
+		/* time decoding only, the file is mapped once */
+		t = 0.0;
+		h = 0;
+		for( k=0; k<popts.repeat; k++ ) {
+			clock_gettime( CLOCK_MONOTONIC, &t0 );
+			img = msevi_l15hrit_decode_segment( seg );
+			clock_gettime( CLOCK_MONOTONIC, &t1 );
+			if( img==NULL ) {
+				fprintf( stderr, "Unable to decode segment %s\n", argv[i] );
+				return -1;
+			}
+			t += elapsed( &t0, &t1 );
+			if( k==0 ) h = checksum( img->counts, (size_t)img->nlin*img->ncol );
+			msevi_l15_image_free( img );
+		}
+		npix = seg->hdr.img_struct.nlin*seg->hdr.img_struct.ncol;
+		printf( "%s: %dx%d compression=%d %.3f ms %016llx\n", argv[i],
+			seg->hdr.img_struct.nlin, seg->hdr.img_struct.ncol,
+			seg->hdr.img_struct.compression, 1e3*t/popts.repeat,
+			(unsigned long long) h );
+		ttot     += t;
+		npix_tot += (double) npix*popts.repeat;
+		msevi_l15hrit_close_segment( seg );
+	}
+	printf( "total: %d segments, %.3f s, %.1f Mpixel/s\n", argc-optind, ttot,
+		1e-6*npix_tot/ttot );
+	return 0;
+}
@@ -10,36 +10,56 @@
 #include <time.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <poll.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include <hdf5.h>
 #include <hdf5_hl.h>
 
 /* local includes */
 #include "mathutils.h"
+#include "memutils.h"
 #include "timeutils.h"
 #include "fileutils.h"
+#include "tarutils.h"
 #include "h5utils.h"
 #include "cgms_xrit.h"
 #include "cds_time.h"
 #include "msevi_l15data.h"
 #include "msevi_l15hrit.h"
 #include "msevi_l15hdf.h"
+#include "msevi_l15cat.h"
 #include "geos.h"
 #include "sunpos.h"
+#include "msevi_orbit.h"
 
 struct prog_opts {
 	int    nchan;
 	char   *chan[12];
 	time_t time;
 	char   *dir;
+	char   *catalog;
 	char   *region;
 	char   *service;
-	struct msevi_l15_coverage coverage;
 	int    sunpos;
 	int    satpos;
 	bool   write_geolocation;
 	bool   write_sun_angles;
 	bool   write_sat_angles;
+	bool   watch;
+	int    timeout;
+	int    nthreads;
+	char   *cache;
+	int    cache_size;
+	int    tile_nlin;
+	int    tile_ncol;
+	bool   hugepages;
+	bool   orbit;
+	int    calibrated;
 } popts= {
 	.nchan    = 12,
 	.chan     = { "vis006", "vis008", "ir_016", "ir_039", "wv_062",
@@ -47,45 +67,81 @@ struct prog_opts {
 		      "ir_134", "hrv" },
 	.time     = 0,
 	.dir      = ".",
+	.catalog  = NULL,
 	.region   = "eu",
 	.service  = "pzs",
-	//.coverage = { "vis_ir", 2957, 3556, 1557, 2356}, /* RSS */
-	.coverage = { "vis_ir", 2957, 3556, 1357, 2156}, /* HRS */
 	.sunpos   = 0,
 	.satpos   = 0,
 	.write_geolocation = false,
 	.write_sun_angles  = true,
 	.write_sat_angles  = true,
+	.watch    = false,
+	.timeout  = 900,
+	.nthreads = 1,
+	.cache    = NULL,
+	.cache_size = 4096,
+	.tile_nlin  = 0,
+	.tile_ncol  = 0,
+	.hugepages  = false,
+	.calibrated = 0,
 };
 
+/* modes of writing calibrated images */
+#define CALIB_NONE  0   /* counts only */
+#define CALIB_ADD   1   /* calibrated images next to the counts */
+#define CALIB_ONLY  2   /* calibrated images instead of the counts */
+
+/* arena for the transient allocations of a repeat cycle */
+static struct mem_arena *cycle_arena = NULL;
+
 static void print_usage (char *prog_name)
 {
 	printf ( "Usage: %s [OPTS]\n"
 		 "Convert METEOSAT SEVIRI HRIT files to HDF5 format\n\n"
 		 "Options:\n"
 		 "\t-h, --help\t\tshow this help message\n"
-		 "\t-d DIR, --dir=DIR\tdirectory containing the HRIT files (default:\n\t\t\t\tcurrent dir)\n"
+		 "\t-d DIR, --dir=DIR\tdirectory or uncompressed tar archive containing\n\t\t\t\tthe HRIT files (default: current dir)\n"
+		 "\t-C FILE, --catalog=FILE\tlook up HRIT files in catalog instead of DIR\n"
 		 "\t-S, --sun\t\tadd sun angles\n"
 		 "\t-V, --view\t\tadd satellite viewing angles\n"
-		 "\t-r, --region\t\tspecify region\n"
+		 "\t-r, --region\t\tspecify region, or a comma separated list of regions\n\t\t\t\twhich are extracted in one pass over the segments\n"
 		 "\t-s, --service\t\tspecify satellite service (pzs or rss)\n"
-		 "\t-t TIME, --time=TIME\ttime of SEVIRI scan\n", prog_name );
+		 "\t-t TIME, --time=TIME\ttime of SEVIRI scan\n"
+		 "\t-j N, --threads=N\tdecode the segments of a channel using N threads\n"
+		 "\t-k DIR, --cache=DIR\tcache decompressed segments in DIR\n"
+		 "\t-K MB, --cache-size=MB\tsize limit of the segment cache (default: 4096)\n"
+		 "\t-b NxM, --tile=NxM\tkeep images in tiles of N lines and M columns,\n\t\t\t\tand write them with one HDF5 chunk per tile\n"
+		 "\t-H, --hugepages\t\tuse huge pages for image and geometry buffers\n"
+		 "\t-O, --orbit\t\tcalculate satellite angles from the true satellite\n\t\t\t\tposition of each line, given by the orbit coefficients\n"
+		 "\t-R MODE, --calibrated=MODE\n\t\t\t\twrite reflectances of the solar and brightness\n\t\t\t\ttemperatures of the thermal channels, next to the\n\t\t\t\tcounts (MODE=add) or instead of them (MODE=only)\n"
+		 "\t-w, --watch\t\twatch DIR for incoming HRIT files, and convert\n\t\t\t\teach repeat cycle as soon as it is complete\n"
+		 "\t-T SEC, --timeout=SEC\tconvert or discard incomplete repeat cycles\n\t\t\t\tafter SEC seconds in watch mode (default: 900)\n", prog_name );
 	return;
 }
 
 static int parse_args (int argc, char **argv)
 {
 	int  optidx = 1, r=-1;
-	char optstr[] = "hSVc:d:r:s:t:";
+	char optstr[] = "hHOSVwb:c:C:d:j:k:K:r:R:s:t:T:";
 	char c;
 
 	const struct option pargs [] = {
                  { .name = "help",    .has_arg = 0, .flag = NULL, .val = 'h'},
                  { .name = "chan",    .has_arg = 1, .flag = NULL, .val = 'c'},
                  { .name = "dir",     .has_arg = 1, .flag = NULL, .val = 'd'},
+                 { .name = "catalog", .has_arg = 1, .flag = NULL, .val = 'C'},
                  { .name = "time",    .has_arg = 1, .flag = NULL, .val = 't'},
                  { .name = "region",  .has_arg = 1, .flag = NULL, .val = 'r'},
                  { .name = "service", .has_arg = 1, .flag = NULL, .val = 's'},
+                 { .name = "watch",   .has_arg = 0, .flag = NULL, .val = 'w'},
+                 { .name = "timeout", .has_arg = 1, .flag = NULL, .val = 'T'},
+                 { .name = "threads", .has_arg = 1, .flag = NULL, .val = 'j'},
+                 { .name = "cache",   .has_arg = 1, .flag = NULL, .val = 'k'},
+                 { .name = "cache-size", .has_arg = 1, .flag = NULL, .val = 'K'},
+                 { .name = "tile",    .has_arg = 1, .flag = NULL, .val = 'b'},
+                 { .name = "hugepages", .has_arg = 0, .flag = NULL, .val = 'H'},
+                 { .name = "orbit",   .has_arg = 0, .flag = NULL, .val = 'O'},
+                 { .name = "calibrated", .has_arg = 1, .flag = NULL, .val = 'R'},
 	};
 
 	while (1) {
@@ -117,11 +173,49 @@ static int parse_args (int argc, char **argv)
 		case 'd':
 			popts.dir = optarg;
 			break;
+		case 'C':
+			popts.catalog = optarg;
+			break;
+		case 'w':
+			popts.watch = true;
+			break;
+		case 'T':
+			popts.timeout = atoi(optarg);
+			break;
+		case 'j':
+			popts.nthreads = atoi(optarg);
+			break;
+		case 'k':
+			popts.cache = optarg;
+			break;
+		case 'K':
+			popts.cache_size = atoi(optarg);
+			break;
+		case 'H':
+			popts.hugepages = true;
+			break;
+		case 'O':
+			popts.orbit = true;
+			break;
+		case 'R':
+			if( 0==strcmp(optarg, "add") ) {
+				popts.calibrated = CALIB_ADD;
+			} else if( 0==strcmp(optarg, "only") ) {
+				popts.calibrated = CALIB_ONLY;
+			} else {
+				return -1;
+			}
+			break;
+		case 'b':
+			if( sscanf( optarg, "%dx%d", &popts.tile_nlin, &popts.tile_ncol )!=2
+			    || popts.tile_nlin<=0 || popts.tile_ncol<=0 ) return -1;
+			break;
 		default:
 			return -1;
 		}
 	}
-	return r;
+	/* the time is taken from the file names in watch mode */
+	return popts.watch ? 0 : r;
 }
 
 int write_cds_time( hid_t hid, char *name, int n, struct cds_time *t )
@@ -192,106 +286,161 @@ static char *find_config_file(char *fnam )
 	return NULL;
 }
 
-int main (int argc, char **argv)
-{
-	hid_t fid;
-	hid_t img_gid, meta_gid, lsi_gid, geom_gid;
-	int i, r, npix, sat_id;
-	char *fnam_hdf = NULL;
-	struct msevi_l15hrit_flist *flist;
-	double x0, y0, dx, dy;
-	const int coff=1856, cfac=13642337, loff=1856, lfac=13642337;
-
-	char tstamp[32], sbuf[4096], host[32];
-	time_t now;
+/* maximum number of regions extracted in one pass */
+#define MAX_REGIONS  8
 
-	struct msevi_l15_header  *header;
-	struct msevi_l15_trailer *trailer;
-	struct msevi_l15_image   *img;
-	struct msevi_satinf      *satinf;
-	struct msevi_region      *reg;
-
-	char *timestr;
-	struct cds_time *line_acq_time;
+/* set the coverage of a channel image covering a region */
+static void channel_coverage( struct msevi_region *reg, int id,
+			      struct msevi_l15_coverage *cov )
+{
+	struct msevi_l15_coverage visir;
+
+	memset( &visir, 0, sizeof(visir) );
+	strcpy( visir.channel, "vis_ir" );
+	visir.northern_line  = 3712-reg->lin0;
+	visir.southern_line  = 3712-(reg->lin0+reg->nlin-1);
+	visir.western_column = 3712-reg->col0;
+	visir.eastern_column = 3712-(reg->col0+reg->ncol-1);
+
+	if( id==MSEVI_CHAN_HRV ) {
+		memset( cov, 0, sizeof(*cov) );
+		coverage_visir2hrv( &visir, cov );
+	} else {
+		memcpy( cov, &visir, sizeof(*cov) );
+	}
+	return;
+}
 
-	hsize_t dim[2];
-	float *lat, *lon, *muS, *azS;
-	uint16_t *sat_zen, *sat_azi, *sun_zen, *sun_azi;
-	// RSS: reg_str = "800x600+1356+156";
-	// HRS: reg_str = "800x600+1556+156";
-	// StratoCu: reg_str = "354x37+1502+2380";
-	struct geos_param *gp;
-	double proj_ss_lon = 0.0, true_ss_lon = 0.0;
-	char *satinf_file=NULL, *reg_file=NULL;
+/* read the comma separated list of regions from the config file */
+static int read_regions( struct msevi_region **reg )
+{
+	int  i, n = 0;
+	char *reg_file=NULL, *list, *name, *saveptr;
 
-	/* parse command line arguments */
-	if (parse_args (argc, argv) <0) {
-		print_usage( argv[0] );
+	/* Read region information from config file */
+	reg_file = find_config_file( "msevi_region.json" );
+	if( reg_file==NULL ) {
+		printf("ERROR: Unable to find config file: msevi_region.json\n" );
+		printf("Set env. variable MSEVI_ANC_DIR to point to its directory\n" );
 		return -1;
 	}
-
-	/* get filenames  */
-	flist = msevi_l15hrit_get_flist( popts.dir, &popts.time, popts.service );
-	if( (flist->prologue==NULL) | (flist->epilogue==NULL) ) {
-		fprintf( stderr, "Unable to find pro/epilogue files\n" );
-		goto err_out;
+	list = strdup( popts.region );
+	if( list==NULL ) goto err_out;
+	for( name=strtok_r(list, ",", &saveptr); name!=NULL;
+	     name=strtok_r(NULL, ",", &saveptr) ) {
+		/* regions given twice are extracted once */
+		for( i=0; i<n; i++ ) {
+			if( strncmp(reg[i]->name, name, sizeof(reg[i]->name))==0 ) break;
+		}
+		if( i<n ) continue;
+		if( n==MAX_REGIONS ) {
+			printf("ERROR: more than %d regions\n", MAX_REGIONS);
+			goto err_out;
+		}
+		reg[n] = msevi_read_region( reg_file, popts.service, name );
+		if( reg[n]==NULL ) {
+			printf("ERROR: region=%s svc=%s\n", name, popts.service);
+			printf("Unable to find region\n");
+			goto err_out;
+		}
+		n++;
 	}
+	free(list);
+	free(reg_file);
+	return n;
 
-	/* read pro/epilogue */
-	header  = msevi_l15hrit_read_prologue( flist->prologue );
-	trailer = msevi_l15hrit_read_epilogue( flist->epilogue );
-	if( (header == NULL) | (trailer == NULL) ) {
-		fprintf(stderr, "Unable to read HRIT pro/epilogue files\n");
-		printf("%s\n", flist->prologue);
-		printf("%s\n", flist->epilogue);
-		goto err_out;
-	}
+err_out:
+	for( i=0; i<n; i++ ) free( reg[i] );
+	free(list);
+	free(reg_file);
+	return -1;
+}
 
-	/* init misc. parameters */
-	sat_id = header->satellite_status.satellite_definition.satellite_id;
+/* read the information of a satellite from the config file */
+static struct msevi_satinf *load_satinf( int sat_id )
+{
+	struct msevi_satinf *satinf;
+	char *satinf_file;
 
-	/* Read satellite information from config file */
 	satinf_file = find_config_file( "msevi_satinf.json" );
 	if( satinf_file==NULL ) {
 		printf("ERROR: Unable to find config file: msevi_satinf.json\n" );
 		printf("Set env. variable MSEVI_ANC_DIR to point to its directory\n" );
-		return -1;
+		return NULL;
 	}
 	satinf = msevi_read_satinf( satinf_file, sat_id );
 	if( satinf==NULL ) {
 		printf("ERROR: sat_id=%d\n", sat_id );
 		printf("Unable to read satellite info\n" );
-		return -1;
 	}
 	free(satinf_file);
+	return satinf;
+}
 
-	/* Read region information from config file */
-	reg_file = find_config_file( "msevi_region.json" );
-	if( reg_file==NULL ) {
-		printf("ERROR: Unable to find config file: msevi_region.json\n" );
-		printf("Set env. variable MSEVI_ANC_DIR to point to its directory\n" );
-		return -1;
-	}
-	reg = msevi_read_region( reg_file, popts.service, popts.region );
-	if( reg==NULL ) {
-		printf("ERROR: region=%s svc=%s\n", popts.region, popts.service);
-		printf("Unable to find region\n");
-		return -1;
+/* packed table of the calibrated values of an annotated image, brightness
+   temperatures for the thermal channels and reflectances otherwise */
+static void calib_lut( struct msevi_l15_image *img, uint16_t *lut )
+{
+	struct msevi_l15_calib cal;
+
+	msevi_l15_calib_init( &cal, img );
+	if( img->channel_id>=MSEVI_CHAN_IR_039 && img->channel_id<=MSEVI_CHAN_IR_134 ) {
+		msevi_l15_calib_pack( cal.bt, MSEVI_L15_BT_SCALE, 0.0, lut );
+	} else {
+		msevi_l15_calib_pack( cal.refl, MSEVI_L15_REFL_SCALE, 0.0, lut );
 	}
-	free(reg_file);
+	return;
+}
+
+/* write the images of all channels of one repeat cycle to HDF5 */
+static int write_hdf( char *outdir, time_t cycle_time, struct msevi_region *reg,
+		      struct msevi_l15_header *header, struct msevi_l15_trailer *trailer,
+		      struct msevi_l15_image **images )
+{
+	hid_t fid = -1;
+	hid_t img_gid = -1, meta_gid = -1, lsi_gid = -1, geom_gid = -1;
+	int i, r, npix, sat_id, ret = -1;
+	char *fnam_hdf = NULL;
+	struct msevi_l15_coverage coverage;
+	double x0, y0, dx, dy;
+	const int coff=1856, cfac=13642337, loff=1856, lfac=13642337;
+
+	char tstamp[32], sbuf[4096], host[32];
+	time_t now;
+
+	struct msevi_l15_image   *img;
+	struct msevi_satinf      *satinf = NULL;
 
-	popts.coverage.northern_line  = 3712-reg->lin0;
-	popts.coverage.southern_line  = 3712-(reg->lin0+reg->nlin-1);
-	popts.coverage.western_column = 3712-reg->col0;
-	popts.coverage.eastern_column = 3712-(reg->col0+reg->ncol-1);
+	char *timestr;
+	struct cds_time *line_acq_time;
 
-	line_acq_time = calloc( reg->nlin, sizeof(struct cds_time));
+	hsize_t dim[2];
+	float *lat = NULL, *lon = NULL, *muS = NULL, *azS = NULL;
+	double *satpos = NULL;
+	uint16_t *sat_zen = NULL, *sat_azi = NULL, *sun_zen = NULL, *sun_azi = NULL;
+	// RSS: reg_str = "800x600+1356+156";
+	// HRS: reg_str = "800x600+1556+156";
+	// StratoCu: reg_str = "354x37+1502+2380";
+	struct geos_param *gp = NULL;
+	double proj_ss_lon = 0.0, true_ss_lon = 0.0;
+
+	/* init misc. parameters */
+	channel_coverage( reg, MSEVI_CHAN_VIS006, &coverage );
+	sat_id = header->satellite_status.satellite_definition.satellite_id;
+
+	/* Read satellite information from config file */
+	satinf = load_satinf( sat_id );
+	if( satinf==NULL ) return -1;
+
+	line_acq_time = mem_arena_calloc( cycle_arena, reg->nlin, sizeof(struct cds_time));
+	if( line_acq_time==NULL ) goto err_out;
 
 	/* Create file ... */
-	fnam_hdf = calloc( strlen(popts.dir)+256, 1 );
-	timestr = get_utc_timestr( "%Y%m%dt%H%Mz", popts.time );
-	sprintf( fnam_hdf, "%s/%s-sevi-%s-l15hdf-%s-%s.c2.h5", popts.dir, satinf->name, timestr,
-		 popts.service, popts.region );
+	fnam_hdf = mem_arena_calloc( cycle_arena, strlen(outdir)+256, 1 );
+	if( fnam_hdf==NULL ) goto err_out;
+	timestr = get_utc_timestr( "%Y%m%dt%H%Mz", cycle_time );
+	sprintf( fnam_hdf, "%s/%s-sevi-%s-l15hdf-%s-%s.c2.h5", outdir, satinf->name, timestr,
+		 popts.service, reg->name );
 	printf( "Creating: %s\n", fnam_hdf );
 	free(timestr);
 
@@ -325,34 +474,40 @@ int main (int argc, char **argv)
 	if(geom_gid<0) goto err_out;
 
 	/* add coverage */
-	msevi_l15hdf_write_coverage( meta_gid, "coverage", &popts.coverage );
+	msevi_l15hdf_write_coverage( meta_gid, "coverage", &coverage );
 
-	/* ... read channels and add images to HDF file */
+	/* ... add images to HDF file */
 	for( i=0; i<popts.nchan; i++ ) {
 		int r, id;
 		struct msevi_chaninf *chaninf;
 
-		printf( "Reading channel=%s\n", popts.chan[i] );
+		img = images[i];
 		id = msevi_chan2id( popts.chan[i] );
-		if( id!=12 ) { /* normal resolution channels */
-			img = msevi_l15hrit_read_image( flist->nseg[id-1], flist->channel[id-1],
-							&popts.coverage );
-		} else {
-			/* HRV channel */
-			struct msevi_l15_coverage hrv_cov;
-			coverage_visir2hrv( &popts.coverage, &hrv_cov);
-			img = msevi_l15hrit_read_image( flist->nseg[id-1], flist->channel[id-1],
-							&hrv_cov );
-
-			msevi_l15hdf_append_coverage( meta_gid, "coverage", &hrv_cov );
+		if( id==MSEVI_CHAN_HRV ) {
+			msevi_l15hdf_append_coverage( meta_gid, "coverage", &img->coverage );
 		}
-		if(img==NULL) goto err_out;
 		chaninf = msevi_get_chaninf( satinf, id );
 		msevi_l15hrit_annotate_image( img, header, trailer, chaninf );
 
 		/* save image information to hdf */
-		r = msevi_l15hdf_write_image( img_gid, img );
-		if(r<0) goto err_out;
+		if( popts.calibrated!=CALIB_ONLY ) {
+			r = msevi_l15hdf_write_image( img_gid, img );
+			if(r<0) goto err_out;
+		}
+
+		/* calibrated values, if not looked up while mapping the segments,
+		   e.g. in watch mode */
+		if( popts.calibrated!=CALIB_NONE ) {
+			if( img->calib==NULL ) {
+				uint16_t lut[MSEVI_L15_NCOUNT];
+
+				calib_lut( img, lut );
+				if( msevi_l15_image_alloc_calib( img )<0 ) goto err_out;
+				msevi_l15_image_apply_calib( img, lut );
+			}
+			r = msevi_l15hdf_write_calibrated( img_gid, img );
+			if(r<0) goto err_out;
+		}
 
 		r = msevi_l15hdf_write_line_side_info( lsi_gid, img );
 		if(r<0) goto err_out;
@@ -381,7 +536,6 @@ int main (int argc, char **argv)
 		} else {
 			msevi_l15hdf_append_chaninf( meta_gid, "channel_info", chaninf );
 		}
-		msevi_l15_image_free( img );
 	}
 
 	/* add geometry */
@@ -389,15 +543,17 @@ int main (int argc, char **argv)
 	proj_ss_lon = header->image_description.projection_description.longitude_of_ssp;
 	printf("Sub-Satellite Longitude: true=%.3f proj=%.3f\n", true_ss_lon, proj_ss_lon );
 
-	x0 = -DEG2RAD((double)(popts.coverage.western_column-coff)*65536/cfac);
+	x0 = -DEG2RAD((double)(coverage.western_column-coff)*65536/cfac);
 	dx = DEG2RAD((double)65536/cfac);
-	y0 = DEG2RAD((double)(popts.coverage.northern_line-loff)*65536/lfac);
+	y0 = DEG2RAD((double)(coverage.northern_line-loff)*65536/lfac);
 	dy = -DEG2RAD((double)65536/lfac);
 	gp = geos_init( x0, y0, dx, dy );
+	if( gp==NULL ) goto err_out;
 
 	npix = reg->nlin*reg->ncol;
-	lat = calloc(npix, sizeof(float));
-	lon = calloc(npix, sizeof(float));
+	/* geometry arrays are pooled, and completely written below */
+	lat = mem_pool_alloc(npix*sizeof(float));
+	lon = mem_pool_alloc(npix*sizeof(float));
 	if( lat==NULL || lon==NULL ) goto err_out;
 
 	/* calculate geolocation and satellite/sun angles */
@@ -417,18 +573,34 @@ int main (int argc, char **argv)
 
 	if( popts.write_sat_angles ) {
 
-		sat_zen = calloc(npix, sizeof(uint16_t));
-		sat_azi = calloc(npix, sizeof(uint16_t));
+		sat_zen = mem_pool_alloc(npix*sizeof(uint16_t));
+		sat_azi = mem_pool_alloc(npix*sizeof(uint16_t));
 
-		muS = calloc(npix, sizeof(float));
-		azS = calloc(npix, sizeof(float));
+		muS = mem_pool_alloc(npix*sizeof(float));
+		azS = mem_pool_alloc(npix*sizeof(float));
 
 		if( sat_zen==NULL || sat_azi==NULL || muS==NULL || azS==NULL ) {
 			printf("Allocation of satellite angles failed!");
 			goto err_out;
 		}
 
-		geos_satpos2d( gp, true_ss_lon, reg->nlin, reg->ncol, lat, lon, muS, azS );
+		if( popts.orbit ) {
+			/* true position at the acquisition time of each line,
+			   the nominal one for lines without valid time */
+			satpos = mem_pool_alloc(reg->nlin*3*sizeof(double));
+			if( satpos==NULL ) goto err_out;
+			msevi_orbit_eval( &header->satellite_status.orbit, reg->nlin,
+					  line_acq_time, satpos, NULL );
+			for( i=0; i<reg->nlin; i++ ) {
+				if( !isnan(satpos[3*i]) ) continue;
+				satpos[3*i]   = gp->h*cos(DEG2RAD(true_ss_lon));
+				satpos[3*i+1] = gp->h*sin(DEG2RAD(true_ss_lon));
+				satpos[3*i+2] = 0.0;
+			}
+			geos_satpos2d_ecef( gp, reg->nlin, reg->ncol, lat, lon, satpos, muS, azS );
+		} else {
+			geos_satpos2d( gp, true_ss_lon, reg->nlin, reg->ncol, lat, lon, muS, azS );
+		}
 		for(i=0;i<npix;i++) sat_zen[i] = (uint16_t) round(RAD2DEG(acosf(muS[i]))*100.0);
 		for(i=0;i<npix;i++) sat_azi[i] = (uint16_t) round(azS[i]*100.0);
 
@@ -443,22 +615,29 @@ int main (int argc, char **argv)
 				    0.01, 0.0 );
 		if(r<0) goto err_out;
 
-		free(sat_zen);
-		free(sat_azi);
-		free(muS);
-		free(azS);
+		/* release the buffers for reuse by the sun angles */
+		mem_pool_free(sat_zen);
+		mem_pool_free(sat_azi);
+		sat_zen = sat_azi = NULL;
 	}
 
 	if( popts.write_sun_angles ) {
 
-		sun_zen = calloc(npix, sizeof(uint16_t));
-		sun_azi = calloc(npix, sizeof(uint16_t));
+		sun_zen = mem_pool_alloc(npix*sizeof(uint16_t));
+		sun_azi = mem_pool_alloc(npix*sizeof(uint16_t));
 
 		if( sun_zen==NULL || sun_azi==NULL) {
 			printf("Allocation of sun angles failed!");
 			goto err_out;
 		}
 
+		/* lines without acquisition time are skipped by sunpos2d */
+		for( i=0; i<reg->nlin; i++ ) {
+			if( line_acq_time[i].days!=0 ) continue;
+			memset( sun_zen+(size_t)i*reg->ncol, 0, reg->ncol*sizeof(uint16_t) );
+			memset( sun_azi+(size_t)i*reg->ncol, 0, reg->ncol*sizeof(uint16_t) );
+		}
+
 		sunpos2d( line_acq_time, reg->nlin, reg->ncol, lat, lon, sun_zen, sun_azi );
 
 		r = H5UTmake_dataset( geom_gid, "sun_zenith", 2, dim, H5T_NATIVE_UINT16, sun_zen, 6 );
@@ -470,35 +649,419 @@ int main (int argc, char **argv)
 		r = sdset_annotate( geom_gid, "sun_azimuth", "sun azimuth angle", "degrees", 0.01, 0.0 );
 		if(r<0) goto err_out;
 
-		free(sun_zen);
-		free(sun_azi);
 	}
+	ret = 0;
 
-	/* close group/file */
-	free(lat);
-	free(lon);
+err_out:
+	if( ret<0 ) printf("Error\n");
+
+	/* release pooled buffers, on error as well, so that they are reused
+	   by the following repeat cycles */
+	mem_pool_free(sun_zen);
+	mem_pool_free(sun_azi);
+	mem_pool_free(sat_zen);
+	mem_pool_free(sat_azi);
+	mem_pool_free(satpos);
+	mem_pool_free(muS);
+	mem_pool_free(azS);
+	mem_pool_free(lat);
+	mem_pool_free(lon);
+	geos_free(gp);
 
 	/* close image group/file */
 	printf( "Closing file and exit...\n" );
-	H5Gclose( img_gid );
-	H5Gclose( lsi_gid );
-	H5Gclose( meta_gid );
-	H5Gclose( geom_gid );
-	H5Fclose( fid );
+	if( img_gid>=0 ) H5Gclose( img_gid );
+	if( lsi_gid>=0 ) H5Gclose( lsi_gid );
+	if( meta_gid>=0 ) H5Gclose( meta_gid );
+	if( geom_gid>=0 ) H5Gclose( geom_gid );
+	if( fid>=0 ) H5Fclose( fid );
 
 	/* cleanup */
+	free(satinf);
+
+	return ret;
+}
+
+/* allocate the image of a channel, covering the region, from the buffer
+   pool. The counts are cleared, as segments may be missing in watch mode */
+static struct msevi_l15_image *channel_image_alloc( struct msevi_region *reg, int id )
+{
+	struct msevi_l15_image *img;
+	struct msevi_l15_coverage cov;
+
+	channel_coverage( reg, id, &cov );
+	img = msevi_l15_image_alloc_pooled( cov.northern_line-cov.southern_line+1,
+					    cov.western_column-cov.eastern_column+1,
+					    popts.tile_nlin, popts.tile_ncol );
+	if(img==NULL) return NULL;
+	msevi_l15_image_clear( img );
+	memcpy( &img->coverage, &cov, sizeof(cov) );
+	img->channel_id = id;
+	return img;
+}
+
+/* bounding box of two coverages */
+static void coverage_union( struct msevi_l15_coverage *c1, struct msevi_l15_coverage *c2 )
+{
+	c1->southern_line  = MIN(c1->southern_line,  c2->southern_line);
+	c1->northern_line  = MAX(c1->northern_line,  c2->northern_line);
+	c1->eastern_column = MIN(c1->eastern_column, c2->eastern_column);
+	c1->western_column = MAX(c1->western_column, c2->western_column);
+	return;
+}
+
+/* convert the repeat cycle given on the command line, writing one file
+   per region */
+static int convert_cycle( int nreg, struct msevi_region **reg )
+{
+	int i, k, r = -1;
+	struct msevi_l15hrit_flist *flist = NULL;
+	struct msevi_l15_header  *header = NULL;
+	struct msevi_l15_trailer *trailer = NULL;
+	struct msevi_l15_image   *img[MAX_REGIONS][12] = {};
+	struct msevi_satinf      *satinf = NULL;
+	uint16_t lut[12][MSEVI_L15_NCOUNT];
+	char dirbuf[PATH_MAX], *outdir;
+
+	/* get filenames  */
+	if( popts.catalog ) {
+		struct msevi_l15cat *cat;
+
+		cat = msevi_l15cat_open( popts.catalog );
+		if( cat==NULL ) {
+			fprintf( stderr, "Unable to open catalog %s\n", popts.catalog );
+			goto err_out;
+		}
+		flist = msevi_l15cat_get_flist( cat, &popts.time, popts.service );
+		msevi_l15cat_close( cat );
+	} else {
+		flist = msevi_l15hrit_get_flist( popts.dir, &popts.time, popts.service );
+	}
+	if( flist==NULL || (flist->prologue==NULL) | (flist->epilogue==NULL) ) {
+		fprintf( stderr, "Unable to find pro/epilogue files\n" );
+		goto err_out;
+	}
+
+	/* read pro/epilogue */
+	header  = msevi_l15hrit_read_prologue( flist->prologue );
+	trailer = msevi_l15hrit_read_epilogue( flist->epilogue );
+	if( (header == NULL) | (trailer == NULL) ) {
+		fprintf(stderr, "Unable to read HRIT pro/epilogue files\n");
+		printf("%s\n", flist->prologue);
+		printf("%s\n", flist->epilogue);
+		goto err_out;
+	}
+
+	/* the calibration is known from the prologue, so that the calibrated
+	   values are looked up while mapping the segments */
+	if( popts.calibrated!=CALIB_NONE ) {
+		satinf = load_satinf( header->satellite_status.satellite_definition.satellite_id );
+		if( satinf==NULL ) goto err_out;
+		for( i=0; i<popts.nchan; i++ ) {
+			struct msevi_l15_image cimg = {};
+
+			cimg.channel_id = msevi_chan2id( popts.chan[i] );
+			msevi_l15hrit_annotate_image( &cimg, header, trailer,
+						      msevi_get_chaninf(satinf, cimg.channel_id) );
+			calib_lut( &cimg, lut[i] );
+			msevi_l15hrit_set_calib( cimg.channel_id, lut[i] );
+		}
+	}
+
+	/* ... read channels, decoding each segment once for all regions */
+	for( i=0; i<popts.nchan; i++ ) {
+		int id, nseg;
+		char *files[MSEVI_NSEG+2];
+		struct msevi_l15_coverage cov[MAX_REGIONS], all;
+		struct msevi_l15_image *chimg[MAX_REGIONS];
+
+		printf( "Reading channel=%s\n", popts.chan[i] );
+		id = msevi_chan2id( popts.chan[i] );
+		for( k=0; k<nreg; k++ ) {
+			channel_coverage( reg[k], id, cov+k );
+			if( k==0 ) memcpy( &all, cov, sizeof(all) );
+			else coverage_union( &all, cov+k );
+		}
+		nseg = msevi_l15hrit_select_segments( flist, id, &all, files );
+		if( msevi_l15hrit_read_images( nseg, files, nreg, cov, chimg )<0 ) goto err_out;
+		for( k=0; k<nreg; k++ ) img[k][i] = chimg[k];
+	}
+
+	/* Create files next to the tar archive, or in the HRIT directory */
+	snprintf( dirbuf, PATH_MAX, "%s", popts.dir );
+	outdir = is_tar_file(popts.dir) ? dirname(dirbuf) : dirbuf;
+	r = 0;
+	for( k=0; k<nreg; k++ ) {
+		if( write_hdf( outdir, popts.time, reg[k], header, trailer, img[k] )<0 ) r = -1;
+	}
+
+err_out:
+	for( k=0; k<nreg; k++ ) {
+		for( i=0; i<popts.nchan; i++ ) msevi_l15_image_free( img[k][i] );
+	}
+	for( i=0; i<popts.nchan; i++ ) msevi_l15hrit_set_calib( msevi_chan2id(popts.chan[i]), NULL );
+	free(satinf);
 	msevi_l15hrit_free_flist( flist );
 	free(header);
 	free(trailer);
-	free(line_acq_time);
-	free(satinf);
+	mem_arena_reset( cycle_arena );
+	return r;
+}
+
+/* number of repeat cycles assembled concurrently in watch mode */
+#define WATCH_NCYCLE  4
+
+/* a repeat cycle being assembled in watch mode */
+struct watch_cycle {
+	time_t   time;          /* repeat cycle time, 0 if slot is unused */
+	time_t   first_seen;
+	struct msevi_l15_header  *header;
+	struct msevi_l15_trailer *trailer;
+	struct msevi_l15_image   *img[MAX_REGIONS][12];
+	uint32_t required[12];  /* bit mask of the segments overlapping any region */
+	uint32_t done[12];      /* bit mask of the decoded segments */
+};
 
-	return  0;
+/* return a bit mask of the segments overlapping a coverage, segment n
+   covering lines (n-1)*464+1 to n*464 */
+static uint32_t required_segments( struct msevi_l15_coverage *cov )
+{
+	int n;
+	uint32_t mask = 0;
+
+	for( n=1; n<=MSEVI_NSEG; n++ ) {
+		if( cov->southern_line<=n*464 && cov->northern_line>(n-1)*464 )
+			mask |= 1u<<n;
+	}
+	return mask;
+}
+
+static void watch_cycle_free( struct watch_cycle *c )
+{
+	int i, k;
+
+	for( k=0; k<MAX_REGIONS; k++ ) {
+		for( i=0; i<popts.nchan; i++ ) msevi_l15_image_free( c->img[k][i] );
+	}
+	free( c->header );
+	free( c->trailer );
+	memset( c, 0, sizeof(*c) );
+	return;
+}
+
+static int watch_cycle_init( struct watch_cycle *c, time_t cycle_time,
+			     int nreg, struct msevi_region **reg )
+{
+	int i, k, id;
+	struct msevi_l15_coverage cov;
+
+	memset( c, 0, sizeof(*c) );
+	c->time = cycle_time;
+	c->first_seen = time(NULL);
+	for( i=0; i<popts.nchan; i++ ) {
+		id = msevi_chan2id( popts.chan[i] );
+		for( k=0; k<nreg; k++ ) {
+			channel_coverage( reg[k], id, &cov );
+			c->required[i] |= required_segments( &cov );
+			c->img[k][i] = channel_image_alloc( reg[k], id );
+			if( c->img[k][i]==NULL ) {
+				watch_cycle_free( c );
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int watch_cycle_complete( struct watch_cycle *c )
+{
+	int i;
+
+	if( c->header==NULL || c->trailer==NULL ) return 0;
+	for( i=0; i<popts.nchan; i++ ) {
+		if( (c->done[i] & c->required[i])!=c->required[i] ) return 0;
+	}
+	return 1;
+}
+
+/* write a repeat cycle, if its pro/epilogue are present, and free it */
+static void watch_cycle_finish( struct watch_cycle *c, int nreg, struct msevi_region **reg )
+{
+	int  k;
+	char timestr[16];
+
+	snprint_utc_timestr( timestr, 16, "%Y%m%d%H%M", c->time );
+	if( c->header==NULL || c->trailer==NULL ) {
+		fprintf( stderr, "WARNING: discarding incomplete repeat cycle %s\n", timestr );
+	} else {
+		if( !watch_cycle_complete(c) ) {
+			fprintf( stderr, "WARNING: repeat cycle %s is missing segments\n", timestr );
+		}
+		for( k=0; k<nreg; k++ ) {
+			if( write_hdf( popts.dir, c->time, reg[k], c->header, c->trailer,
+				       c->img[k] )<0 ) {
+				fprintf( stderr, "ERROR: unable to write repeat cycle %s region %s\n",
+					 timestr, reg[k]->name );
+			}
+		}
+	}
+	watch_cycle_free( c );
+	mem_arena_reset( cycle_arena );
+	return;
+}
+
+/* find the slot of a repeat cycle, starting a new one if needed */
+static struct watch_cycle *watch_cycle_get( struct watch_cycle *cyc, time_t cycle_time,
+					    int nreg, struct msevi_region **reg )
+{
+	int i;
+	struct watch_cycle *c = NULL;
+
+	for( i=0; i<WATCH_NCYCLE; i++ ) {
+		if( cyc[i].time==cycle_time ) return cyc+i;
+	}
+
+	/* use a free slot, or finish the oldest repeat cycle */
+	for( i=0; i<WATCH_NCYCLE; i++ ) {
+		if( cyc[i].time==0 ) {
+			c = cyc+i;
+			break;
+		}
+		if( c==NULL || cyc[i].time<c->time ) c = cyc+i;
+	}
+	if( c->time!=0 ) watch_cycle_finish( c, nreg, reg );
+	if( watch_cycle_init( c, cycle_time, nreg, reg )<0 ) return NULL;
+	return c;
+}
+
+/* decode a newly arrived file into its repeat cycle */
+static void watch_add_file( struct watch_cycle *cyc, char *name,
+			    int nreg, struct msevi_region **reg )
+{
+	int i = 0, k, rss;
+	char path[PATH_MAX];
+	struct msevi_l15hrit_fname fn;
+	struct msevi_l15hrit_segment *seg;
+	struct watch_cycle *c;
+	struct msevi_l15_image *img[MAX_REGIONS];
+
+	if( msevi_l15hrit_parse_fname(name, &fn)<0 ) return;
+	rss = (0==strncasecmp(popts.service,"rss",3));
+	if( fn.rss!=rss ) return;
+
+	/* skip channels not requested */
+	if( fn.ftype==XRIT_FTPYE_IMAGE ) {
+		for( i=0; i<popts.nchan; i++ ) {
+			if( msevi_chan2id(popts.chan[i])==fn.channel_id ) break;
+		}
+		if( i==popts.nchan ) return;
+	}
+
+	c = watch_cycle_get( cyc, fn.time, nreg, reg );
+	if( c==NULL ) return;
+	snprintf( path, PATH_MAX, "%s/%s", popts.dir, name );
+
+	if( fn.ftype==MSEVI_L15HRIT_PROLOGUE ) {
+		free( c->header );
+		c->header = msevi_l15hrit_read_prologue( path );
+	} else if( fn.ftype==MSEVI_L15HRIT_EPILOGUE ) {
+		free( c->trailer );
+		c->trailer = msevi_l15hrit_read_epilogue( path );
+	} else if( c->required[i] & (1u<<fn.segment) ) {
+		for( k=0; k<nreg; k++ ) img[k] = c->img[k][i];
+		seg = msevi_l15hrit_open_segment( path );
+		if( seg==NULL || msevi_l15hrit_add_segment_multi(nreg, img, seg)<0 ) {
+			fprintf( stderr, "WARNING: unable to decode %s\n", path );
+		} else {
+			c->done[i] |= 1u<<fn.segment;
+		}
+		msevi_l15hrit_close_segment( seg );
+	}
+
+	if( watch_cycle_complete(c) ) watch_cycle_finish( c, nreg, reg );
+	return;
+}
+
+/* watch the HRIT directory, and convert repeat cycles as they arrive */
+static int watch_dir( int nreg, struct msevi_region **reg )
+{
+	int fd, i, n;
+	char buf[sizeof(struct inotify_event)+NAME_MAX+1]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	struct watch_cycle cyc[WATCH_NCYCLE];
+	struct pollfd pfd;
+	time_t now;
+
+	memset( cyc, 0, sizeof(cyc) );
+
+	fd = inotify_init1( IN_CLOEXEC );
+	if( fd<0 ) goto err_out;
+	if( inotify_add_watch( fd, popts.dir, IN_CLOSE_WRITE|IN_MOVED_TO )<0 ) {
+		fprintf( stderr, "ERROR: unable to watch %s\n", popts.dir );
+		goto err_out;
+	}
+	printf( "Watching: %s\n", popts.dir );
+	setvbuf( stdout, NULL, _IOLBF, 0 );
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for(;;) {
+		/* finish repeat cycles which timed out */
+		now = time(NULL);
+		for( i=0; i<WATCH_NCYCLE; i++ ) {
+			if( cyc[i].time!=0 && now-cyc[i].first_seen>popts.timeout )
+				watch_cycle_finish( cyc+i, nreg, reg );
+		}
+
+		n = poll( &pfd, 1, 1000 );
+		if( n<0 ) goto err_out;
+		if( n==0 ) continue;
+
+		n = read( fd, buf, sizeof(buf) );
+		if( n<=0 ) goto err_out;
+		for( i=0; i<n; i+=sizeof(*ev)+ev->len ) {
+			ev = (struct inotify_event *) (buf+i);
+			if( ev->len>0 ) watch_add_file( cyc, ev->name, nreg, reg );
+		}
+	}
 
 err_out:
-	printf("Error\n");
+	if( fd>=0 ) close( fd );
+	for( i=0; i<WATCH_NCYCLE; i++ ) watch_cycle_free( cyc+i );
 	return -1;
-
 }
 
+int main (int argc, char **argv)
+{
+	int r, k, nreg;
+	struct msevi_region *reg[MAX_REGIONS];
+
+	/* parse command line arguments */
+	if (parse_args (argc, argv) <0) {
+		print_usage( argv[0] );
+		return -1;
+	}
+
+	nreg = read_regions( reg );
+	if( nreg<=0 ) return -1;
+	msevi_l15hrit_set_nthreads( popts.nthreads );
+	msevi_l15hrit_set_tile_size( popts.tile_nlin, popts.tile_ncol );
+	mem_pool_set_hugepages( popts.hugepages );
+	cycle_arena = mem_arena_create( 0 );
+	if( cycle_arena==NULL ) return -1;
+	if( popts.cache ) {
+		mkdir( popts.cache, 0755 );
+		msevi_l15hrit_set_cache( popts.cache, (size_t)popts.cache_size<<20 );
+	}
 
+	if( popts.watch ) {
+		r = watch_dir( nreg, reg );
+	} else {
+		r = convert_cycle( nreg, reg );
+	}
+	for( k=0; k<nreg; k++ ) free( reg[k] );
+	mem_arena_destroy( cycle_arena );
+	mem_pool_trim();
+	return r;
+}
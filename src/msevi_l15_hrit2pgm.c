@@ -34,6 +34,8 @@ struct prog_opts{
 	char   *chan[12];
 	time_t time;
 	char   *dir;
+	char   *service;
+	int    scale;
 	struct msevi_l15_coverage coverage;
 	int    sunpos;
 	int    satpos;
@@ -45,6 +47,8 @@ struct prog_opts{
 	.chan     = { "vis006", "vis008", "ir_016", "ir_108" },
 	.time     = 0,
 	.dir      = ".",
+	.service  = "pzs",
+	.scale    = 1,
 	.coverage = { "vis_ir", 1296, 1332, 1857, 2210 }, /* RSS */
 	// .coverage = { "vis_ir", 2957, 3556, 1557, 2356}, /* RSS */
 	//.coverage = { "vis_ir", 2957, 3556, 1357, 2156}, /* HRS */
@@ -62,6 +66,8 @@ static void print_usage (char *prog_name)
 		 "Options:\n"
 		 "\t-h, --help\t\tshow this help message\n"
 		 "\t-d DIR, --dir=DIR\tdirectory containing the HRIT files (default:\n\t\t\t\tcurrent dir)\n"
+		 "\t-s, --service\t\tspecify satellite service (pzs or rss)\n"
+		 "\t-x N, --scale=N\t\treduce the resolution by a factor of N, e.g. 2, 4\n\t\t\t\tor 8, for quicklooks (default: 1)\n"
 		 "\t-S, --sun\t\tadd sun angles\n"
 		 "\t-V, --view\t\tadd satellite viewing angles\n"
 		 "\t-t TIME, --time=TIME\ttime of SEVIRI scan\n", prog_name );
@@ -71,7 +77,7 @@ static void print_usage (char *prog_name)
 static int parse_args (int argc, char **argv)
 {
 	int  optidx = 1, r=-1;
-	char optstr[] = "hSVc:d:r:t:";
+	char optstr[] = "hSVc:d:r:s:t:x:";
 	char c;
 
 	const struct option pargs [] = {
@@ -80,6 +86,8 @@ static int parse_args (int argc, char **argv)
                  { .name = "dir",    .has_arg = 1, .flag = NULL, .val = 'd'},
                  { .name = "time",   .has_arg = 1, .flag = NULL, .val = 't'},
                  { .name = "region", .has_arg = 1, .flag = NULL, .val = 'r'},
+                 { .name = "service", .has_arg = 1, .flag = NULL, .val = 's'},
+                 { .name = "scale",  .has_arg = 1, .flag = NULL, .val = 'x'},
 	};
 
 	while (1) {
@@ -104,6 +112,13 @@ static int parse_args (int argc, char **argv)
 		case 'd':
 			popts.dir = optarg;
 			break;
+		case 's':
+			popts.service = optarg;
+			break;
+		case 'x':
+			popts.scale = atoi( optarg );
+			if( popts.scale<1 ) return -1;
+			break;
 		default:
 			return -1;
 		}
@@ -162,7 +177,8 @@ int main (int argc, char **argv)
 	}
 
 	/* get filenames  */
-	flist = msevi_l15hrit_get_flist( popts.dir, &popts.time );
+	flist = msevi_l15hrit_get_flist( popts.dir, &popts.time, popts.service );
+	if( flist==NULL ) goto err_out;
 	if( (flist->prologue==NULL) | (flist->epilogue==NULL) ) {
 		fprintf( stderr, "Unable to find pro/epilogue files\n" );
 		goto err_out;
@@ -194,6 +210,12 @@ int main (int argc, char **argv)
 	case 322:
 		sat = "msg2";
 		break;
+	case 323:
+		sat = "msg3";
+		break;
+	case 324:
+		sat = "msg4";
+		break;
 	default:
 		printf("ERROR: unknown sat_id=%d\n", sat_id );
 		return -1;
@@ -213,10 +235,15 @@ int main (int argc, char **argv)
 
 		printf( "Reading channel=%s\n", popts.chan[i] );
 		id  = msevi_chan2id( popts.chan[i] );
-		img = msevi_l15hrit_read_image( flist->nseg[id-1], flist->channel[id-1],
-						&popts.coverage );
+		if( popts.scale>1 ) {
+			img = msevi_l15hrit_read_image_scaled( flist->nseg[id-1], flist->channel[id-1],
+							       &popts.coverage, popts.scale );
+		} else {
+			img = msevi_l15hrit_read_image( flist->nseg[id-1], flist->channel[id-1],
+							&popts.coverage );
+		}
 		if(img==NULL) goto err_out;
-		msevi_l15hrit_annotate_image( img, header, trailer );
+		msevi_l15hrit_annotate_image( img, header, trailer, NULL );
 		sprintf( cal_str, "cal_slope=%.8f cal_offset=%.8f", img->cal_slope, img->cal_offset );
 		write_pgm( fnam_pgm, img->nlin, img->ncol, img->counts, cal_str );
 		msevi_l15_image_free( img );
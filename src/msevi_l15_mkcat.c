@@ -0,0 +1,88 @@
+/* system includes */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+/* local includes */
+#include "cds_time.h"
+#include "cgms_xrit.h"
+#include "msevi_l15data.h"
+#include "msevi_l15hrit.h"
+#include "msevi_l15cat.h"
+
+struct prog_opts {
+	char   *dir;
+	char   *catalog;
+} popts= {
+	.dir      = ".",
+	.catalog  = NULL,
+};
+
+static void print_usage (char *prog_name)
+{
+	printf ( "Usage: %s [OPTS]\n"
+		 "Create or update the catalog of a METEOSAT SEVIRI HRIT archive directory\n"
+		 "or uncompressed tar file\n\n"
+		 "Options:\n"
+		 "\t-h, --help\t\tshow this help message\n"
+		 "\t-d DIR, --dir=DIR\tdirectory or uncompressed tar archive containing\n\t\t\t\tthe HRIT files (default: current dir)\n"
+		 "\t-C FILE, --catalog=FILE\tcatalog file to create or update\n", prog_name );
+	return;
+}
+
+static int parse_args (int argc, char **argv)
+{
+	int  optidx = 1;
+	char optstr[] = "hC:d:";
+	char c;
+
+	const struct option pargs [] = {
+                 { .name = "help",    .has_arg = 0, .flag = NULL, .val = 'h'},
+                 { .name = "catalog", .has_arg = 1, .flag = NULL, .val = 'C'},
+                 { .name = "dir",     .has_arg = 1, .flag = NULL, .val = 'd'},
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, optstr, pargs, &optidx);
+
+		if (c == -1) break;
+		switch (c) {
+		case 'h':
+			print_usage(argv[0]);
+			exit(0);
+		case 'C':
+			popts.catalog = optarg;
+			break;
+		case 'd':
+			popts.dir = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return (popts.catalog==NULL) ? -1 : 0;
+}
+
+int main (int argc, char **argv)
+{
+	int n;
+
+	/* parse command line arguments */
+	if (parse_args (argc, argv) <0) {
+		print_usage( argv[0] );
+		return -1;
+	}
+
+	n = msevi_l15cat_update( popts.catalog, popts.dir );
+	if( n<0 ) {
+		fprintf( stderr, "Unable to update catalog %s\n", popts.catalog );
+		return -1;
+	}
+	printf( "%s: %d files\n", popts.catalog, n );
+	return 0;
+}
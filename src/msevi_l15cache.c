@@ -0,0 +1,318 @@
+/**
+ *  \file    msevi_l15cache.c
+ *  \brief   On-disk cache of decompressed SEVIRI L15 HRIT segments
+ *
+ *  Each cache entry holds the decompressed counts of one image segment, or
+ *  other data such as prologue records, in a file named after the cache
+ *  key. Keys are derived from the segment
+ *  file name, size and modification time, so that modified files are not
+ *  served from the cache. Entries are written to a temporary file and
+ *  renamed, and are only read through read-only mappings, so that several
+ *  processes can share a cache directory. The modification time of an
+ *  entry is updated on each hit, and the least recently used entries are
+ *  evicted when the cache exceeds its size limit. The cache size is
+ *  scanned once, and then tracked across puts, so that the directory is
+ *  only scanned again when the limit is exceeded.
+ */
+
+/* System includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Local includes */
+#include "msevi_l15cache.h"
+
+/* fraction of the size limit the cache is reduced to on eviction */
+#define EVICT_FRACTION  0.9
+
+struct cache_file {
+	char   name[32];
+	time_t mtime;
+	off_t  size;
+};
+
+/* size of the entries in the cache directory, as of the last scan plus
+   the entries put since, 0 if not scanned yet */
+static char   total_dir[PATH_MAX];
+static size_t total_size = 0;
+static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t fnv1a( uint64_t h, const void *p, size_t n )
+{
+	const uint8_t *b = p;
+	size_t i;
+
+	for( i=0; i<n; i++ ) h = (h ^ b[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static int entry_path( char *path, char *dir, uint64_t key )
+{
+	if( snprintf( path, PATH_MAX, "%s/%016llx.seg", dir,
+		      (unsigned long long) key )>=PATH_MAX ) return -1;
+	return 0;
+}
+
+static int cache_file_cmp( const void *p1, const void *p2 )
+{
+	const struct cache_file *f1 = p1, *f2 = p2;
+
+	if( f1->mtime<f2->mtime ) return -1;
+	if( f1->mtime>f2->mtime ) return  1;
+	return 0;
+}
+
+/* evict least recently used entries, if the cache exceeds max_size, and
+   return the size of the remaining entries */
+static size_t evict( char *dir, size_t max_size )
+{
+	int    n = 0, nalloc = 0, i;
+	size_t total = 0;
+	char   path[PATH_MAX];
+	struct cache_file *f = NULL, *tmp;
+	struct dirent *de;
+	struct stat st;
+	DIR   *dp;
+
+	dp = opendir( dir );
+	if( dp==NULL ) return 0;
+	while( (de=readdir(dp))!=NULL ) {
+		if( strlen(de->d_name)!=20 || strcmp(de->d_name+16, ".seg")!=0 ) continue;
+		snprintf( path, PATH_MAX, "%s/%s", dir, de->d_name );
+		if( stat(path, &st)<0 ) continue;
+		if( n==nalloc ) {
+			nalloc = (nalloc==0) ? 256 : 2*nalloc;
+			tmp = realloc( f, nalloc*sizeof(*f) );
+			if( tmp==NULL ) break;
+			f = tmp;
+		}
+		strcpy( f[n].name, de->d_name );
+		f[n].mtime = st.st_mtime;
+		f[n].size  = st.st_size;
+		total += st.st_size;
+		n++;
+	}
+	closedir( dp );
+
+	if( total>max_size ) {
+		qsort( f, n, sizeof(*f), cache_file_cmp );
+		for( i=0; i<n && total>EVICT_FRACTION*max_size; i++ ) {
+			snprintf( path, PATH_MAX, "%s/%s", dir, f[i].name );
+			if( unlink(path)==0 ) total -= f[i].size;
+		}
+	}
+	free( f );
+	return total;
+}
+
+/**
+ * \brief  Compute the cache key of a segment
+ *
+ * \param[in]  fnam     the segment file name, or NULL
+ * \param[in]  hdr      the XRIT header of the segment
+ * \param[in]  hdr_len  the length of the header
+ * \param[in]  data_len the length of the segment data
+ *
+ * \return     the key, derived from the file name, size and modification
+ *             time, and the XRIT header. For segments which are not plain
+ *             files, e.g. tar members, the file name, header and data length
+ *             are used.
+ */
+uint64_t msevi_l15cache_key( char *fnam, void *hdr, size_t hdr_len, uint64_t data_len )
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	struct stat st;
+
+	if( fnam ) {
+		h = fnv1a( h, fnam, strlen(fnam) );
+		if( stat(fnam, &st)==0 ) {
+			h = fnv1a( h, &st.st_size, sizeof(st.st_size) );
+			h = fnv1a( h, &st.st_mtim, sizeof(st.st_mtim) );
+		}
+	}
+	h = fnv1a( h, &data_len, sizeof(data_len) );
+	return fnv1a( h, hdr, hdr_len );
+}
+
+/* map a cache entry, checking its header */
+static int entry_get( char *dir, uint64_t key, int type, int nlin, int ncol,
+		      size_t size, struct msevi_l15cache_entry *e )
+{
+	int fd;
+	char path[PATH_MAX];
+	struct stat st;
+	struct msevi_l15cache_header *hdr;
+
+	memset( e, 0, sizeof(*e) );
+	if( entry_path( path, dir, key )<0 ) return -1;
+	fd = open( path, O_RDONLY );
+	if( fd<0 ) return -1;
+	if( fstat(fd, &st)<0 || st.st_size!=sizeof(*hdr)+size ) {
+		close( fd );
+		return -1;
+	}
+	e->map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( e->map==MAP_FAILED ) {
+		e->map = NULL;
+		return -1;
+	}
+	e->map_len = st.st_size;
+
+	hdr = e->map;
+	if(    memcmp( hdr->magic, MSEVI_L15CACHE_MAGIC, 8 )!=0
+	    || hdr->version!=MSEVI_L15CACHE_VERSION || hdr->type!=type
+	    || hdr->key!=key || hdr->nlin!=nlin || hdr->ncol!=ncol ) {
+		msevi_l15cache_release( e );
+		return -1;
+	}
+	e->data = e->map+sizeof(*hdr);
+
+	/* mark entry as recently used */
+	utimensat( AT_FDCWD, path, NULL, 0 );
+	return 0;
+}
+
+/* write a cache entry to a temporary file, and rename it */
+static int entry_put( char *dir, size_t max_size, uint64_t key, int type,
+		      int nlin, int ncol, void *data, size_t size )
+{
+	char path[PATH_MAX], tmpfile[PATH_MAX];
+	struct msevi_l15cache_header hdr;
+	FILE *fp;
+
+	memset( &hdr, 0, sizeof(hdr) );
+	memcpy( hdr.magic, MSEVI_L15CACHE_MAGIC, 8 );
+	hdr.version = MSEVI_L15CACHE_VERSION;
+	hdr.type    = type;
+	hdr.nlin    = nlin;
+	hdr.ncol    = ncol;
+	hdr.key     = key;
+
+	if( entry_path( path, dir, key )<0 ) return -1;
+	if( snprintf( tmpfile, PATH_MAX, "%s.%d.tmp", path,
+		      (int) getpid() )>=PATH_MAX ) return -1;
+	fp = fopen( tmpfile, "wb" );
+	if( fp==NULL ) return -1;
+	if(    fwrite( &hdr, sizeof(hdr), 1, fp )!=1
+	    || fwrite( data, 1, size, fp )!=size ) {
+		fclose( fp );
+		unlink( tmpfile );
+		return -1;
+	}
+	if( fclose(fp)!=0 || rename(tmpfile, path)<0 ) {
+		unlink( tmpfile );
+		return -1;
+	}
+
+	/* scan the directory on the first put, and when the limit is
+	   exceeded, only */
+	pthread_mutex_lock( &total_lock );
+	if( total_size==0 || strcmp(total_dir, dir)!=0 ) {
+		snprintf( total_dir, PATH_MAX, "%s", dir );
+		total_size = evict( dir, max_size );
+	} else {
+		total_size += sizeof(hdr)+size;
+		if( total_size>max_size ) total_size = evict( dir, max_size );
+	}
+	pthread_mutex_unlock( &total_lock );
+	return 0;
+}
+
+/**
+ * \brief  Look up a segment in the cache
+ *
+ * \param[in]  dir    the cache directory
+ * \param[in]  key    the cache key
+ * \param[in]  nlin   the number of segment lines
+ * \param[in]  ncol   the number of segment columns
+ * \param[out] e      the mapped entry, with the counts as data, to be
+ *                    released by msevi_l15cache_release()
+ *
+ * \return     0 on a cache hit, or -1 otherwise
+ */
+int msevi_l15cache_get( char *dir, uint64_t key, int nlin, int ncol,
+			struct msevi_l15cache_entry *e )
+{
+	return entry_get( dir, key, MSEVI_L15CACHE_SEGMENT, nlin, ncol,
+			  (size_t)nlin*ncol*sizeof(uint16_t), e );
+}
+
+/**
+ * \brief  Release a cache entry
+ *
+ * \param[in]  e      the entry
+ *
+ * \return     nothing
+ */
+void msevi_l15cache_release( struct msevi_l15cache_entry *e )
+{
+	if( e->map ) munmap( e->map, e->map_len );
+	memset( e, 0, sizeof(*e) );
+	return;
+}
+
+/**
+ * \brief  Store a decompressed segment in the cache
+ *
+ * \param[in]  dir       the cache directory
+ * \param[in]  max_size  the size limit of the cache, in bytes
+ * \param[in]  key       the cache key
+ * \param[in]  nlin      the number of segment lines
+ * \param[in]  ncol      the number of segment columns
+ * \param[in]  counts    the decompressed counts
+ *
+ * \return     0 on success, or -1 on error
+ */
+int msevi_l15cache_put( char *dir, size_t max_size, uint64_t key, int nlin, int ncol,
+			uint16_t *counts )
+{
+	return entry_put( dir, max_size, key, MSEVI_L15CACHE_SEGMENT, nlin, ncol,
+			  counts, (size_t)nlin*ncol*sizeof(uint16_t) );
+}
+
+/**
+ * \brief  Look up other data in the cache, e.g. a decoded prologue
+ *
+ * \param[in]  dir    the cache directory
+ * \param[in]  key    the cache key
+ * \param[in]  type   the type of the entry, e.g. MSEVI_L15CACHE_PROLOGUE
+ * \param[in]  size   the size of the data
+ * \param[out] e      the mapped entry, to be released by msevi_l15cache_release()
+ *
+ * \return     0 on a cache hit, or -1 otherwise
+ */
+int msevi_l15cache_get_data( char *dir, uint64_t key, int type, size_t size,
+			     struct msevi_l15cache_entry *e )
+{
+	return entry_get( dir, key, type, 0, 0, size, e );
+}
+
+/**
+ * \brief  Store other data in the cache, e.g. a decoded prologue
+ *
+ * \param[in]  dir       the cache directory
+ * \param[in]  max_size  the size limit of the cache, in bytes
+ * \param[in]  key       the cache key
+ * \param[in]  type      the type of the entry, e.g. MSEVI_L15CACHE_PROLOGUE
+ * \param[in]  data      the data
+ * \param[in]  size      the size of the data
+ *
+ * \return     0 on success, or -1 on error
+ */
+int msevi_l15cache_put_data( char *dir, size_t max_size, uint64_t key, int type,
+			     void *data, size_t size )
+{
+	return entry_put( dir, max_size, key, type, 0, 0, data, size );
+}
@@ -0,0 +1,48 @@
+#ifndef _MSEVI_L15CACHE_H_
+#define _MSEVI_L15CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MSEVI_L15CACHE_MAGIC    "MSEVISEG"
+#define MSEVI_L15CACHE_VERSION  3
+
+/* types of cache entries */
+#define MSEVI_L15CACHE_SEGMENT   1   /* decompressed segment counts */
+#define MSEVI_L15CACHE_PROLOGUE  2   /* used bytes of prologue records */
+
+/* header of a cache entry, followed by the data, e.g. nlin*ncol counts
+   in native byte order for segments */
+struct msevi_l15cache_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t nlin;
+	uint32_t ncol;
+	uint32_t type;
+	uint64_t key;
+};
+
+/* a cache entry mapped for reading */
+struct msevi_l15cache_entry {
+	void     *data;
+	void     *map;
+	size_t    map_len;
+};
+
+uint64_t msevi_l15cache_key( char *fnam, void *hdr, size_t hdr_len, uint64_t data_len );
+int  msevi_l15cache_get( char *dir, uint64_t key, int nlin, int ncol,
+			 struct msevi_l15cache_entry *e );
+void msevi_l15cache_release( struct msevi_l15cache_entry *e );
+int  msevi_l15cache_put( char *dir, size_t max_size, uint64_t key, int nlin, int ncol,
+			 uint16_t *counts );
+int  msevi_l15cache_get_data( char *dir, uint64_t key, int type, size_t size,
+			      struct msevi_l15cache_entry *e );
+int  msevi_l15cache_put_data( char *dir, size_t max_size, uint64_t key, int type,
+			      void *data, size_t size );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MSEVI_L15CACHE_H_ */
@@ -0,0 +1,359 @@
+/**
+ *  \file    msevi_l15cat.c
+ *  \brief   Persistent catalog of SEVIRI L15 HRIT archive directories
+ *
+ *  The catalog stores the file name, repeat cycle time, channel, segment
+ *  number, coverage and XRIT header/data lengths of every HRIT file in an
+ *  archive directory. It is built once by scanning the directory, and
+ *  updated incrementally afterwards. File lists for a repeat cycle are
+ *  then obtained by a binary search in the memory mapped catalog, instead
+ *  of globbing the directory and opening each segment.
+ */
+
+/* System includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Local includes */
+#include "tarutils.h"
+#include "cgms_xrit.h"
+#include "cds_time.h"
+#include "msevi_l15data.h"
+#include "msevi_l15hrit.h"
+#include "msevi_l15cat.h"
+
+static int entry_cmp( const void *p1, const void *p2 )
+{
+	const struct msevi_l15cat_entry *e1 = p1, *e2 = p2;
+
+	if( e1->time<e2->time ) return -1;
+	if( e1->time>e2->time ) return  1;
+	return strncmp( e1->name, e2->name, sizeof(e1->name) );
+}
+
+/* find the first entry with time >= t */
+static size_t lower_bound( struct msevi_l15cat_entry *ent, size_t n, int64_t t )
+{
+	size_t lo=0, hi=n, mid;
+
+	while( lo<hi ) {
+		mid = lo+(hi-lo)/2;
+		if( ent[mid].time<t ) lo = mid+1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* fill a catalog entry by opening the file */
+static int scan_file( char *dir, char *name, struct msevi_l15hrit_fname *fn,
+		      time_t mtime, struct msevi_l15cat_entry *e )
+{
+	char path[PATH_MAX];
+	size_t len = strlen(name);
+	struct xrit_file *xf;
+	struct msevi_l15hrit_segment *seg;
+
+	memset( e, 0, sizeof(*e) );
+	if( len>=sizeof(e->name) ) return -1;
+	memcpy( e->name, name, len );
+	e->time  = fn->time;
+	e->mtime = mtime;
+	e->ftype = fn->ftype;
+	e->rss   = fn->rss;
+	if( snprintf( path, PATH_MAX, "%s/%s", dir, name )>=PATH_MAX ) goto err_out;
+
+	if( fn->ftype==XRIT_FTPYE_IMAGE ) {
+		seg = msevi_l15hrit_open_segment( path );
+		if(seg==NULL) goto err_out;
+		e->channel_id = seg->hdr.seg_id.channel_id;
+		e->segment    = seg->hdr.seg_id.segm_seq_nr;
+		e->header_len = seg->xf->header_len;
+		e->data_len   = seg->xf->data_len;
+		memcpy( &e->coverage, &seg->coverage, sizeof(e->coverage) );
+		msevi_l15hrit_close_segment( seg );
+	} else {
+		xf = xrit_mopen( path );
+		if(xf==NULL) goto err_out;
+		e->header_len = xf->header_len;
+		e->data_len   = xf->data_len;
+		xrit_fclose( xf );
+	}
+	return 0;
+
+err_out:
+	fprintf( stderr, "WARNING: unable to catalog %s\n", path );
+	return -1;
+}
+
+/**
+ * \brief  Open a SEVIRI L15 HRIT catalog
+ *
+ * \param[in]  file    the catalog file
+ *
+ * \return     the memory mapped catalog, or NULL on error
+ */
+struct msevi_l15cat *msevi_l15cat_open( char *file )
+{
+	int fd = -1;
+	struct stat st;
+	struct msevi_l15cat *cat;
+	void *map;
+
+	cat = calloc( 1, sizeof(*cat) );
+	if( cat==NULL ) goto err_out;
+
+	fd = open( file, O_RDONLY );
+	if( fd<0 ) goto err_out;
+	if( fstat(fd, &st)<0 || st.st_size<sizeof(struct msevi_l15cat_header) )
+		goto err_out;
+
+	map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if( map==MAP_FAILED ) goto err_out;
+	close( fd );
+	fd = -1;
+
+	cat->map_len = st.st_size;
+	cat->hdr = map;
+	cat->ent = map+sizeof(struct msevi_l15cat_header);
+
+	/* check magic, version and size */
+	if(    memcmp( cat->hdr->magic, MSEVI_L15CAT_MAGIC, 8 )!=0
+	    || cat->hdr->version!=MSEVI_L15CAT_VERSION
+	    || cat->map_len!=sizeof(struct msevi_l15cat_header)
+	                     +cat->hdr->nent*sizeof(struct msevi_l15cat_entry) ) {
+		fprintf( stderr, "ERROR: %s is not a valid catalog\n", file );
+		goto err_out;
+	}
+	return cat;
+
+err_out:
+	if( fd>=0 ) close( fd );
+	msevi_l15cat_close( cat );
+	return NULL;
+}
+
+/**
+ * \brief  Close a SEVIRI L15 HRIT catalog
+ *
+ * \param[in]  cat     the catalog, may be NULL
+ *
+ * \return     nothing
+ */
+void msevi_l15cat_close( struct msevi_l15cat *cat )
+{
+	if( cat ) {
+		if( cat->hdr ) munmap( cat->hdr, cat->map_len );
+		free( cat );
+	}
+	return;
+}
+
+/**
+ * \brief  Create or update the catalog of an archive directory
+ *
+ * The archive may also be an uncompressed tar file, in which case its
+ * members are cataloged under the name "archive.tar/member".
+ *
+ * Files already in the catalog with unchanged modification time are
+ * kept without opening them, new or modified files are scanned, and
+ * entries of files no longer present in the directory are dropped.
+ * The updated catalog is written to a temporary file and renamed, so
+ * that readers always see a consistent catalog.
+ *
+ * \param[in]  file    the catalog file
+ * \param[in]  dir     the archive directory or tar file
+ *
+ * \return     the number of catalog entries, or -1 on error
+ */
+int msevi_l15cat_update( char *file, char *dir )
+{
+	int    r = -1, k = 0;
+	size_t nold = 0, nent = 0, nalloc = 0;
+	char  *name;
+	time_t mtime = 0;
+	struct tar_index *ti = NULL;
+	char   absdir[PATH_MAX], path[PATH_MAX], tmpfile[PATH_MAX];
+	struct msevi_l15cat *old = NULL;
+	struct msevi_l15cat_entry *ent = NULL, key;
+	struct msevi_l15cat_header hdr;
+	struct msevi_l15hrit_fname fn;
+	struct dirent *de;
+	struct stat st;
+	DIR  *dp = NULL;
+	FILE *fp = NULL;
+
+	if( realpath(dir, absdir)==NULL ) goto err_out;
+	if( strlen(absdir)>=sizeof(hdr.dir) ) {
+		fprintf( stderr, "ERROR: path of %s exceeds %zu characters\n",
+			 absdir, sizeof(hdr.dir)-1 );
+		goto err_out;
+	}
+
+	/* open existing catalog */
+	if( access(file, F_OK)==0 ) {
+		old = msevi_l15cat_open( file );
+		if( old==NULL ) goto err_out;
+		if( strncmp(old->hdr->dir, absdir, sizeof(old->hdr->dir))!=0 ) {
+			fprintf( stderr, "ERROR: catalog %s is for directory %s\n",
+				 file, old->hdr->dir );
+			goto err_out;
+		}
+		nold = old->hdr->nent;
+	}
+
+	if( is_tar_file(absdir) ) {
+		ti = tar_index_open( absdir );
+		if( ti==NULL ) goto err_out;
+	} else {
+		dp = opendir( absdir );
+		if( dp==NULL ) goto err_out;
+	}
+
+	for(;;) {
+		struct msevi_l15cat_entry *e;
+
+		/* next tar member or directory entry */
+		if( ti ) {
+			if( k>=ti->nmemb ) break;
+			name  = ti->memb[k].name;
+			mtime = ti->memb[k].mtime;
+			k++;
+		} else {
+			if( (de=readdir(dp))==NULL ) break;
+			name = de->d_name;
+		}
+
+		if( strlen(name)>=sizeof(key.name) ) continue;
+		if( msevi_l15hrit_parse_fname(name, &fn)<0 ) continue;
+
+		if( ti==NULL ) {
+			if( snprintf( path, PATH_MAX, "%s/%s", absdir, name )>=PATH_MAX ) continue;
+			if( stat(path, &st)<0 || !S_ISREG(st.st_mode) ) continue;
+			mtime = st.st_mtime;
+		}
+
+		/* grow entry array */
+		if( nent==nalloc ) {
+			nalloc = (nalloc==0) ? 4096 : 2*nalloc;
+			e = realloc( ent, nalloc*sizeof(*ent) );
+			if( e==NULL ) goto err_out;
+			ent = e;
+		}
+
+		/* re-use unmodified entries of the existing catalog */
+		if( nold>0 ) {
+			memset( &key, 0, sizeof(key) );
+			memcpy( key.name, name, strlen(name) );
+			key.time = fn.time;
+			e = bsearch( &key, old->ent, nold, sizeof(key), entry_cmp );
+			if( e!=NULL && e->mtime==mtime ) {
+				memcpy( ent+nent, e, sizeof(*e) );
+				nent++;
+				continue;
+			}
+		}
+		if( scan_file(absdir, name, &fn, mtime, ent+nent)==0 ) nent++;
+	}
+	if( dp ) closedir( dp );
+	dp = NULL;
+
+	qsort( ent, nent, sizeof(*ent), entry_cmp );
+
+	/* write new catalog to temporary file, and replace old one */
+	memset( &hdr, 0, sizeof(hdr) );
+	memcpy( hdr.magic, MSEVI_L15CAT_MAGIC, 8 );
+	hdr.version = MSEVI_L15CAT_VERSION;
+	hdr.nent    = nent;
+	memcpy( hdr.dir, absdir, strlen(absdir) );
+
+	if( snprintf( tmpfile, PATH_MAX, "%s.tmp", file )>=PATH_MAX ) goto err_out;
+	fp = fopen( tmpfile, "wb" );
+	if( fp==NULL ) goto err_out;
+	if( fwrite(&hdr, sizeof(hdr), 1, fp)!=1 ) goto err_out;
+	if( nent>0 && fwrite(ent, sizeof(*ent), nent, fp)!=nent ) goto err_out;
+	if( fclose(fp)!=0 ) {
+		fp = NULL;
+		goto err_out;
+	}
+	fp = NULL;
+	if( rename(tmpfile, file)<0 ) goto err_out;
+	r = nent;
+
+err_out:
+	if( fp ) {
+		fclose( fp );
+		unlink( tmpfile );
+	}
+	if( dp ) closedir( dp );
+	tar_index_free( ti );
+	msevi_l15cat_close( old );
+	free( ent );
+	return r;
+}
+
+/**
+ * \brief  Return a list of SEVIRI L15 HRIT files for one repeat cycle
+ *
+ * \param[in]  cat    the catalog
+ * \param[in]  time   the time of the repeat cycle
+ * \param[in]  svc    the satellite service, pzs or rss
+ *
+ * \return     the list of SEVIRI L15 files, including segment coverage,
+ *             or NULL on error
+ */
+struct msevi_l15hrit_flist *msevi_l15cat_get_flist( struct msevi_l15cat *cat,
+						    time_t *time, char *svc )
+{
+	int    rss, ichan, iseg;
+	size_t i, nent = cat->hdr->nent;
+	char   path[PATH_MAX];
+	struct msevi_l15hrit_flist *flist;
+	struct msevi_l15cat_entry  *e;
+
+	if (0==strncasecmp(svc,"pzs",3)) {
+		rss = 0;
+	} else if (0==strncasecmp(svc,"rss",3)) {
+		rss = 1;
+	} else {
+		fprintf( stderr, "ERROR: unknown service %s\n", svc );
+		return NULL;
+	}
+
+	flist = calloc(1,sizeof(*flist));
+	if(flist==NULL) return NULL;
+
+	for( i=lower_bound(cat->ent, nent, *time); i<nent; i++ ) {
+		e = cat->ent+i;
+		if( e->time!=*time ) break;
+		if( e->rss!=rss ) continue;
+
+		snprintf( path, PATH_MAX, "%s/%s", cat->hdr->dir, e->name );
+		if( e->ftype==MSEVI_L15HRIT_PROLOGUE ) {
+			free( flist->prologue );
+			flist->prologue = strdup( path );
+		} else if( e->ftype==MSEVI_L15HRIT_EPILOGUE ) {
+			free( flist->epilogue );
+			flist->epilogue = strdup( path );
+		} else if( e->channel_id>=1 && e->channel_id<=MSEVI_NCHAN ) {
+			ichan = e->channel_id-1;
+			iseg  = flist->nseg[ichan];
+			if( iseg>=MSEVI_NSEG+2 ) continue;
+			flist->channel[ichan][iseg] = strdup( path );
+			memcpy( &flist->coverage[ichan][iseg], &e->coverage,
+				sizeof(struct msevi_l15_coverage) );
+			flist->nseg[ichan]++;
+		}
+	}
+	return flist;
+}
@@ -0,0 +1,51 @@
+#ifndef _MSEVI_L15CAT_H_
+#define _MSEVI_L15CAT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MSEVI_L15CAT_MAGIC    "MSEVICAT"
+#define MSEVI_L15CAT_VERSION  1
+
+/* catalog entry, one per HRIT file. Entries are stored in native byte
+   order, sorted by repeat cycle time and file name */
+struct msevi_l15cat_entry {
+	char     name[64];
+	int64_t  time;
+	int64_t  mtime;
+	uint8_t  ftype;
+	uint8_t  rss;
+	uint8_t  channel_id;
+	uint8_t  reserved;
+	uint16_t segment;
+	uint16_t reserved2;
+	uint32_t header_len;
+	uint64_t data_len;
+	struct msevi_l15_coverage coverage;
+};
+
+struct msevi_l15cat_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t nent;
+	char     dir[496];
+};
+
+struct msevi_l15cat {
+	struct msevi_l15cat_header *hdr;
+	struct msevi_l15cat_entry  *ent;
+	size_t   map_len;
+};
+
+struct msevi_l15cat *msevi_l15cat_open( char *file );
+void msevi_l15cat_close( struct msevi_l15cat *cat );
+int  msevi_l15cat_update( char *file, char *dir );
+struct msevi_l15hrit_flist *msevi_l15cat_get_flist( struct msevi_l15cat *cat,
+						    time_t *time, char *svc );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MSEVI_L15CAT_H_ */
@@ -7,6 +7,7 @@
 /* Local includes */
 #include "parson.h"
 #include "cds_time.h"
+#include "memutils.h"
 #include "msevi_l15data.h"
 
 /* SEVIRI channel names */
@@ -36,34 +37,167 @@ const char *msevi_id2chan( int id )
 /**
  * \brief  Allocate memory for a SEVIRI L15 image structure
  *
- * \param[in]  coverage the coverage of the image
+ * \param[in]  nlin    the number of image lines
+ * \param[in]  ncol    the number of image columns
  *
- * \return     a pointer to the allocated structure
+ * \return     a pointer to the allocated structure, with row-major counts
  */
 struct msevi_l15_image *msevi_l15_image_alloc( int nlin, int ncol )
 {
+	return msevi_l15_image_alloc_tiled( nlin, ncol, 0, 0 );
+}
+
+/* number of counts of an image, including the padding of tiles */
+static size_t image_npix( int nlin, int ncol, int tile_nlin, int tile_ncol )
+{
+	if( tile_nlin>0 && tile_ncol>0 ) {
+		return (size_t)(nlin+tile_nlin-1)/tile_nlin*tile_nlin
+			* ((ncol+tile_ncol-1)/tile_ncol*tile_ncol);
+	}
+	return (size_t)nlin*ncol;
+}
 
+/**
+ * \brief  Allocate memory for a tiled SEVIRI L15 image structure
+ *
+ * The counts are stored as tiles of tile_nlin*tile_ncol pixels, see
+ * msevi_l15_image_offset(). Use msevi_l15_image_pixel() to access the
+ * counts, or msevi_l15_image_export() to obtain row-major counts.
+ *
+ * \param[in]  nlin       the number of image lines
+ * \param[in]  ncol       the number of image columns
+ * \param[in]  tile_nlin  the number of lines of a tile, 0 for row-major counts
+ * \param[in]  tile_ncol  the number of columns of a tile, 0 for row-major counts
+ *
+ * \return     a pointer to the allocated structure, or NULL on error
+ */
+struct msevi_l15_image *msevi_l15_image_alloc_tiled( int nlin, int ncol,
+						     int tile_nlin, int tile_ncol )
+{
 	struct msevi_l15_image *img;
+	size_t npix;
 
 	img = calloc(1,sizeof(*img));
 	if(img==NULL) goto err_out;
 
 	img->nlin = nlin;
 	img->ncol = ncol;
-	img->counts = calloc( 2, nlin*ncol );
+	if( tile_nlin>0 && tile_ncol>0 ) {
+		img->tile_nlin = tile_nlin;
+		img->tile_ncol = tile_ncol;
+	}
+	npix = image_npix( nlin, ncol, tile_nlin, tile_ncol );
+	img->counts = calloc( npix, sizeof(uint16_t) );
 	img->line_side_info = calloc( nlin,
 		       sizeof(struct msevi_l15_line_side_info) );
+	if( img->counts==NULL || img->line_side_info==NULL ) goto err_out;
 
 	return img;
 
  err_out:
-	if(img) {
-		free(img->counts);
-		free(img->line_side_info);
-	}
+	msevi_l15_image_free( img );
 	return NULL;
 }
 
+/**
+ * \brief  Allocate a SEVIRI L15 image structure from the buffer pool
+ *
+ * The counts are taken from the pool of buffers released by
+ * msevi_l15_image_free(), so that they are reused across channels and
+ * repeat cycles. The image structure and line side information are small,
+ * and allocated by calloc() to not take up a (huge) page of the pool each.
+ * The line side information is zeroed, the counts are not initialised,
+ * see msevi_l15_image_clear().
+ *
+ * \param[in]  nlin       the number of image lines
+ * \param[in]  ncol       the number of image columns
+ * \param[in]  tile_nlin  the number of lines of a tile, 0 for row-major counts
+ * \param[in]  tile_ncol  the number of columns of a tile, 0 for row-major counts
+ *
+ * \return     a pointer to the allocated structure, or NULL on error
+ */
+struct msevi_l15_image *msevi_l15_image_alloc_pooled( int nlin, int ncol,
+						      int tile_nlin, int tile_ncol )
+{
+	struct msevi_l15_image *img;
+	size_t hdr_len = (sizeof(*img)+63)&~(size_t)63;
+	size_t lsi_len = nlin*sizeof(struct msevi_l15_line_side_info);
+
+	img = calloc( 1, hdr_len+lsi_len );
+	if(img==NULL) return NULL;
+	img->nlin = nlin;
+	img->ncol = ncol;
+	if( tile_nlin>0 && tile_ncol>0 ) {
+		img->tile_nlin = tile_nlin;
+		img->tile_ncol = tile_ncol;
+	}
+	img->pooled = 1;
+	img->line_side_info = (void *)img+hdr_len;
+	img->counts = mem_pool_alloc( image_npix(nlin, ncol, tile_nlin, tile_ncol)
+				      *sizeof(uint16_t) );
+	if(img->counts==NULL) {
+		free( img );
+		return NULL;
+	}
+	return img;
+}
+
+/**
+ * \brief  Set all counts of an image to zero
+ *
+ * \param[in]  img    the image
+ *
+ * \return     nothing
+ */
+void msevi_l15_image_clear( struct msevi_l15_image *img )
+{
+	memset( img->counts, 0, image_npix(img->nlin, img->ncol, img->tile_nlin,
+					   img->tile_ncol)*sizeof(uint16_t) );
+	return;
+}
+
+/**
+ * \brief  Return the counts of a tile of a tiled image
+ *
+ * \param[in]  img        the image
+ * \param[in]  itile_lin  the tile row, counted from the northern-most tiles
+ * \param[in]  itile_col  the tile column, counted from the western-most tiles
+ *
+ * \return     a pointer to the tile_nlin*tile_ncol counts of the tile
+ */
+uint16_t *msevi_l15_image_tile( struct msevi_l15_image *img, int itile_lin, int itile_col )
+{
+	return msevi_l15_image_pixel( img, itile_lin*img->tile_nlin,
+				      itile_col*img->tile_ncol );
+}
+
+/**
+ * \brief  Copy the counts of an image in row-major order
+ *
+ * \param[in]  img    the image, row-major or tiled
+ * \param[out] dest   the destination, holding nlin*ncol counts
+ *
+ * \return     nothing
+ */
+void msevi_l15_image_export( struct msevi_l15_image *img, uint16_t *dest )
+{
+	uint32_t il, ic, n;
+
+	if( img->tile_nlin==0 ) {
+		memcpy( dest, img->counts, (size_t)img->nlin*img->ncol*sizeof(uint16_t) );
+		return;
+	}
+	for( il=0; il<img->nlin; il++ ) {
+		for( ic=0; ic<img->ncol; ic+=n ) {
+			n = img->tile_ncol-ic%img->tile_ncol;
+			if( n>img->ncol-ic ) n = img->ncol-ic;
+			memcpy( dest+(size_t)il*img->ncol+ic, msevi_l15_image_pixel(img, il, ic),
+				n*sizeof(uint16_t) );
+		}
+	}
+	return;
+}
+
 /**
  * \brief  Frees a SEVIRI L15 image structure
  *
@@ -73,8 +207,13 @@ struct msevi_l15_image *msevi_l15_image_alloc( int nlin, int ncol )
  */
 void msevi_l15_image_free( struct msevi_l15_image *img )
 {
-	if(img) {
+	if(img && img->pooled) {
+		mem_pool_free(img->counts);
+		mem_pool_free(img->calib);
+		free(img);
+	} else if(img) {
 		free(img->counts);
+		free(img->calib);
 		free(img->line_side_info);
 		free(img);
 	}
@@ -92,21 +231,201 @@ struct msevi_chaninf *msevi_get_chaninf( struct msevi_satinf *satinf, int chan_i
 }
 
 
+/* brightness temperature of a radiance, with the central wavenumber nu
+   in cm-1 and the radiance in mW m-2 sr-1 (cm-1)-1 */
+static inline double rad2bt( double rad, double nu, double alpha, double beta )
+{
+	const double c1 = 1.19104e-5;  /* mW m-2 sr-1 (cm-1)-4 */
+	const double c2 = 1.43877;     /* K cm */
+
+	if( rad<=0.0 ) return NAN;
+	return ( c2*nu/log(1.0+nu*nu*nu*c1/rad) - beta ) / alpha;
+}
+
+/**
+ * \brief  Convert counts to brightness temperatures
+ *
+ * Arrays of at least MSEVI_L15_NCOUNT counts are converted by a lookup
+ * table of the 10-bit counts.
+ *
+ * \param[in]  ci     the channel information
+ * \param[in]  n      the number of counts
+ * \param[in]  cnt    the counts
+ * \param[out] bt     the brightness temperatures
+ *
+ * \return     0
+ */
 int msevi_l15_cnt2bt( struct msevi_chaninf *ci, int n, uint16_t *cnt, float *bt )
 {
 	int i;
-	double nu, rad;
-	const double c1 = 1.19104e-5;
-	const double c2 = 1.43877e-5;
+	float lut[MSEVI_L15_NCOUNT];
 
-	nu = ci->nu_c;
-	for( i=0; i<n; i++ ) {
-		rad = ci->cal_slope*cnt[i] + ci->cal_offset;
-		bt[i] = c2*nu / ( ci->alpha*log(1.0+nu*nu*nu*c1/rad) ) - ci->beta;
+	if( n<MSEVI_L15_NCOUNT ) {
+		for( i=0; i<n; i++ ) {
+			bt[i] = rad2bt( ci->cal_slope*cnt[i] + ci->cal_offset,
+					ci->nu_c, ci->alpha, ci->beta );
+		}
+		return 0;
+	}
+	for( i=0; i<MSEVI_L15_NCOUNT; i++ ) {
+		lut[i] = rad2bt( ci->cal_slope*i + ci->cal_offset,
+				 ci->nu_c, ci->alpha, ci->beta );
+	}
+	lut_gather_f32( bt, lut, cnt, n, MSEVI_L15_NCOUNT-1 );
+	return 0;
+}
+
+/**
+ * \brief  Set up the calibration tables of a channel
+ *
+ * The tables are computed from the calibration of an image annotated by
+ * msevi_l15hrit_annotate_image(), and are valid for all images of the
+ * channel of a repeat cycle.
+ *
+ * \param[out] cal    the calibration tables
+ * \param[in]  img    the annotated image
+ *
+ * \return     nothing
+ */
+void msevi_l15_calib_init( struct msevi_l15_calib *cal, struct msevi_l15_image *img )
+{
+	int i;
+
+	for( i=0; i<MSEVI_L15_NCOUNT; i++ ) {
+		cal->rad[i]  = img->cal_slope*i + img->cal_offset;
+		cal->refl[i] = img->refl_slope*i + img->refl_offset;
+		if( img->alpha>0.0 ) {
+			cal->bt[i] = rad2bt( cal->rad[i], img->nu_c, img->alpha, img->beta );
+		} else {
+			cal->bt[i] = NAN;
+		}
 	}
+	return;
+}
+
+/**
+ * \brief  Convert counts by a calibration table
+ *
+ * \param[in]  lut    the table, e.g. the bt member of msevi_l15_calib
+ * \param[in]  n      the number of counts
+ * \param[in]  cnt    the counts
+ * \param[out] dest   the calibrated values
+ *
+ * \return     nothing
+ */
+void msevi_l15_calib_apply( const float *lut, size_t n, const uint16_t *cnt, float *dest )
+{
+	lut_gather_f32( dest, lut, cnt, n, MSEVI_L15_NCOUNT-1 );
+	return;
+}
+
+/**
+ * \brief  Convert the counts of an image by a calibration table
+ *
+ * \param[in]  img    the image, row-major or tiled
+ * \param[in]  lut    the table, e.g. the bt member of msevi_l15_calib
+ * \param[out] dest   the calibrated values, nlin*ncol values in row-major
+ *                    order
+ *
+ * \return     nothing
+ */
+void msevi_l15_image_calibrate( struct msevi_l15_image *img, const float *lut, float *dest )
+{
+	uint32_t il, ic, n;
+
+	if( img->tile_nlin==0 ) {
+		msevi_l15_calib_apply( lut, (size_t)img->nlin*img->ncol, img->counts, dest );
+		return;
+	}
+	for( il=0; il<img->nlin; il++ ) {
+		for( ic=0; ic<img->ncol; ic+=n ) {
+			n = img->tile_ncol-ic%img->tile_ncol;
+			if( n>img->ncol-ic ) n = img->ncol-ic;
+			msevi_l15_calib_apply( lut, n, msevi_l15_image_pixel(img, il, ic),
+					       dest+(size_t)il*img->ncol+ic );
+		}
+	}
+	return;
+}
+
+/**
+ * \brief  Pack a calibration table to 16bit integers
+ *
+ * The values are packed as (value-offset)/scale, rounded and limited to
+ * [1,65535]. Zero is used as fill value, for NaN values and for the count
+ * zero, which marks missing pixels.
+ *
+ * \param[in]  lut     the table, e.g. the refl member of msevi_l15_calib
+ * \param[in]  scale   the scale factor of the packed values
+ * \param[in]  offset  the offset of the packed values
+ * \param[out] dest    the packed table of MSEVI_L15_NCOUNT entries
+ *
+ * \return     nothing
+ */
+void msevi_l15_calib_pack( const float *lut, double scale, double offset, uint16_t *dest )
+{
+	int i;
+	double v;
+
+	dest[0] = 0;
+	for( i=1; i<MSEVI_L15_NCOUNT; i++ ) {
+		v = round( (lut[i]-offset)/scale );
+		if( isnan(v) ) {
+			dest[i] = 0;
+		} else {
+			dest[i] = (uint16_t) fmin( fmax(v,1.0), 65535.0 );
+		}
+	}
+	return;
+}
+
+/**
+ * \brief  Allocate the calibrated values of an image
+ *
+ * The values are allocated in the layout of the counts, from the buffer
+ * pool for pooled images, and set to the fill value zero.
+ *
+ * \param[in]  img    the image
+ *
+ * \return     0 on success, -1 on error
+ */
+int msevi_l15_image_alloc_calib( struct msevi_l15_image *img )
+{
+	size_t n;
+
+	n = image_npix( img->nlin, img->ncol, img->tile_nlin, img->tile_ncol )
+		* sizeof(uint16_t);
+	if( img->calib==NULL ) {
+		img->calib = img->pooled ? mem_pool_alloc( n ) : malloc( n );
+		if( img->calib==NULL ) return -1;
+	}
+	memset( img->calib, 0, n );
 	return 0;
 }
 
+/**
+ * \brief  Calibrate all counts of an image by a packed table
+ *
+ * This is a separate pass over the counts, for images whose calibration
+ * was not known while their segments were mapped.
+ *
+ * \param[in]  img    the image, with calibrated values allocated by
+ *                    msevi_l15_image_alloc_calib()
+ * \param[in]  lut    the table packed by msevi_l15_calib_pack()
+ *
+ * \return     nothing
+ */
+void msevi_l15_image_apply_calib( struct msevi_l15_image *img, const uint16_t *lut )
+{
+	size_t i, n;
+
+	n = image_npix( img->nlin, img->ncol, img->tile_nlin, img->tile_ncol );
+	for( i=0; i<n; i++ ) {
+		img->calib[i] = lut[img->counts[i]&(MSEVI_L15_NCOUNT-1)];
+	}
+	return;
+}
+
 static int json2chaninf(JSON_Object *chan_obj, struct msevi_chaninf *ci )
 {
 	int chan_id;
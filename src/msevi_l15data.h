@@ -53,10 +53,43 @@ struct msevi_l15_image {
 	double    lambda_c, nu_c, alpha, beta;
 
 	uint16_t  *counts;
+	uint32_t  tile_nlin;   /* tile size, 0 for row-major counts */
+	uint32_t  tile_ncol;
+	uint8_t   pooled;      /* counts allocated from the buffer pool */
+	uint16_t  *calib;      /* scaled calibrated values in the layout of
+				  the counts, or NULL */
+	const uint16_t *calib_lut; /* table of the calibrated values of the
+				      counts, applied while mapping segments
+				      if set */
 	struct msevi_l15_coverage coverage;
 	struct msevi_l15_line_side_info *line_side_info;
 };
 
+/*
+ * Offset of the pixel (lin,col) in the counts of an image. Tiled images
+ * store the tiles in row-major order, each tile as a contiguous, row-major
+ * block of tile_nlin*tile_ncol counts. Tiles at the southern and western
+ * borders are padded to full size.
+ */
+static inline size_t msevi_l15_image_offset( const struct msevi_l15_image *img,
+					     uint32_t lin, uint32_t col )
+{
+	size_t ntile_col;
+
+	if( img->tile_nlin==0 ) return (size_t)lin*img->ncol+col;
+	ntile_col = (img->ncol+img->tile_ncol-1)/img->tile_ncol;
+	return ((lin/img->tile_nlin)*ntile_col+col/img->tile_ncol)
+		*(size_t)img->tile_nlin*img->tile_ncol
+		+ (lin%img->tile_nlin)*img->tile_ncol + col%img->tile_ncol;
+}
+
+/* pointer to the counts of pixel (lin,col) */
+static inline uint16_t *msevi_l15_image_pixel( const struct msevi_l15_image *img,
+					       uint32_t lin, uint32_t col )
+{
+	return img->counts+msevi_l15_image_offset( img, lin, col );
+}
+
 struct msevi_l15_header {
 
 	uint8_t version;
@@ -275,10 +308,43 @@ struct msevi_region {
 	int  ncol;
 };
 
+/* number of entries of the calibration tables, i.e. of 10-bit counts */
+#define MSEVI_L15_NCOUNT 1024
+
+/* calibration tables of a channel, indexed by the counts */
+struct msevi_l15_calib {
+	float rad[MSEVI_L15_NCOUNT];   /* radiance [mW m-2 sr-1 (cm-1)-1] */
+	float refl[MSEVI_L15_NCOUNT];  /* reflectance, zero for channels
+					  without solar irradiance */
+	float bt[MSEVI_L15_NCOUNT];    /* brightness temperature [K], NaN for
+					  channels without thermal band
+					  coefficients or non-positive
+					  radiance */
+};
+
+/* scale factors of calibrated values packed to 16bit integers, zero is
+   the fill value */
+#define MSEVI_L15_REFL_SCALE  1.0e-4
+#define MSEVI_L15_BT_SCALE    1.0e-2
+
 struct msevi_l15_image *msevi_l15_image_alloc( int nlin, int ncol );
+struct msevi_l15_image *msevi_l15_image_alloc_tiled( int nlin, int ncol,
+						     int tile_nlin, int tile_ncol );
+struct msevi_l15_image *msevi_l15_image_alloc_pooled( int nlin, int ncol,
+						      int tile_nlin, int tile_ncol );
+void msevi_l15_image_clear( struct msevi_l15_image *img );
+uint16_t *msevi_l15_image_tile( struct msevi_l15_image *img, int itile_lin, int itile_col );
+void msevi_l15_image_export( struct msevi_l15_image *img, uint16_t *dest );
 void msevi_l15_image_free( struct msevi_l15_image *img );
 
 struct msevi_chaninf *msevi_get_chaninf( struct msevi_satinf *satinf, int chan_id );
+int msevi_l15_cnt2bt( struct msevi_chaninf *ci, int n, uint16_t *cnt, float *bt );
+void msevi_l15_calib_init( struct msevi_l15_calib *cal, struct msevi_l15_image *img );
+void msevi_l15_calib_apply( const float *lut, size_t n, const uint16_t *cnt, float *dest );
+void msevi_l15_image_calibrate( struct msevi_l15_image *img, const float *lut, float *dest );
+void msevi_l15_calib_pack( const float *lut, double scale, double offset, uint16_t *dest );
+int  msevi_l15_image_alloc_calib( struct msevi_l15_image *img );
+void msevi_l15_image_apply_calib( struct msevi_l15_image *img, const uint16_t *lut );
 const int msevi_chan2id( const char *chan );
 const char* msevi_id2chan( int id );
 struct msevi_satinf *msevi_read_satinf( char *file, int sat_id );
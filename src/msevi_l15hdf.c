@@ -12,6 +12,7 @@
 #include "timeutils.h"
 #include "cds_time.h"
 #include "h5utils.h"
+#include "cgms_xrit.h"
 #include "msevi_l15data.h"
 #include "msevi_l15hrit.h"
 
@@ -21,6 +22,57 @@ const char *msevi_l15hdf_meta_grp = "meta";
 const char *msevi_l15hdf_lsi_grp  = "line_side_info";
 
 
+/*
+ * Write the counts of a tiled image, using the tiles as HDF5 chunks, so
+ * that each tile is written as one chunk without repacking the counts.
+ */
+static int write_tiled_counts( hid_t gid, const char *dset, struct msevi_l15_image *img,
+			       int compression )
+{
+	hsize_t dim[2] = { img->nlin, img->ncol };
+	hsize_t tdim[2] = { img->tile_nlin, img->tile_ncol };
+	hsize_t chunk[2], off[2], cnt[2], zero[2] = { 0, 0 };
+	hid_t did = -1, fsid = -1, msid = -1, plist = -1;
+	int r = -1, it, jt, ntile_lin, ntile_col;
+
+	/* chunks may not exceed the dataset */
+	chunk[0] = (tdim[0]<dim[0]) ? tdim[0] : dim[0];
+	chunk[1] = (tdim[1]<dim[1]) ? tdim[1] : dim[1];
+	ntile_lin = (img->nlin+img->tile_nlin-1)/img->tile_nlin;
+	ntile_col = (img->ncol+img->tile_ncol-1)/img->tile_ncol;
+
+	fsid  = H5Screate_simple( 2, dim, NULL );
+	msid  = H5Screate_simple( 2, tdim, NULL );
+	plist = H5Pcreate( H5P_DATASET_CREATE );
+	if( fsid<0 || msid<0 || plist<0 ) goto err_out;
+	if( H5Pset_chunk( plist, 2, chunk )<0 ) goto err_out;
+	if( compression && H5Pset_deflate( plist, compression )<0 ) goto err_out;
+	did = H5Dcreate1( gid, dset, H5T_NATIVE_UINT16, fsid, plist );
+	if( did<0 ) goto err_out;
+
+	for( it=0; it<ntile_lin; it++ ) {
+		for( jt=0; jt<ntile_col; jt++ ) {
+			off[0] = (hsize_t)it*img->tile_nlin;
+			off[1] = (hsize_t)jt*img->tile_ncol;
+			cnt[0] = (dim[0]-off[0]<tdim[0]) ? dim[0]-off[0] : tdim[0];
+			cnt[1] = (dim[1]-off[1]<tdim[1]) ? dim[1]-off[1] : tdim[1];
+			if( H5Sselect_hyperslab( fsid, H5S_SELECT_SET, off, NULL, cnt, NULL )<0
+			    || H5Sselect_hyperslab( msid, H5S_SELECT_SET, zero, NULL, cnt, NULL )<0 )
+				goto err_out;
+			if( H5Dwrite( did, H5T_NATIVE_UINT16, msid, fsid, H5P_DEFAULT,
+				      msevi_l15_image_tile(img, it, jt) )<0 ) goto err_out;
+		}
+	}
+	r = 0;
+
+err_out:
+	if( did>=0 ) H5Dclose( did );
+	if( plist>=0 ) H5Pclose( plist );
+	if( msid>=0 ) H5Sclose( msid );
+	if( fsid>=0 ) H5Sclose( fsid );
+	return r;
+}
+
 /* write MSG SEIVIR image */
 int msevi_l15hdf_write_image( hid_t gid, struct msevi_l15_image *img )
 {
@@ -31,8 +83,12 @@ int msevi_l15hdf_write_image( hid_t gid, struct msevi_l15_image *img )
 	/* create dataset name */
 	snprintf(dset, 32, "image_%s", msevi_id2chan(img->channel_id) );
 
-	/* write dataset */
-	r = H5UTmake_dataset( gid, dset, 2, dim, H5T_NATIVE_UINT16, img->counts, 6 );
+	/* write dataset, with one chunk per tile for tiled images */
+	if( img->tile_nlin>0 ) {
+		r = write_tiled_counts( gid, dset, img, 6 );
+	} else {
+		r = H5UTmake_dataset( gid, dset, 2, dim, H5T_NATIVE_UINT16, img->counts, 6 );
+	}
 	if(r<0) goto err_out;
 
 	/* add attributes */
@@ -67,6 +123,59 @@ err_out:
 	return -1;
 }
 
+/*
+ * Write the calibrated values of an image, as reflectance for the solar
+ * channels and as brightness temperature for the thermal channels,
+ * scaled to 16bit integers with zero as fill value.
+ */
+int msevi_l15hdf_write_calibrated( hid_t gid, struct msevi_l15_image *img )
+{
+	hsize_t dim[2] = { img->nlin, img->ncol };
+	char dset[48], long_name[64];
+	struct msevi_l15_image cal;
+	double scale, offset = 0.0;
+	uint16_t fill = 0;
+	int r, thermal;
+
+	if( img->calib==NULL ) return -1;
+	thermal = img->channel_id>=MSEVI_CHAN_IR_039 && img->channel_id<=MSEVI_CHAN_IR_134;
+	scale = thermal ? MSEVI_L15_BT_SCALE : MSEVI_L15_REFL_SCALE;
+	snprintf( dset, 48, "%s_%s", thermal ? "brightness_temperature" : "reflectance",
+		  msevi_id2chan(img->channel_id) );
+
+	/* the calibrated values share the layout of the counts */
+	if( img->tile_nlin>0 ) {
+		memcpy( &cal, img, sizeof(cal) );
+		cal.counts = img->calib;
+		r = write_tiled_counts( gid, dset, &cal, 6 );
+	} else {
+		r = H5UTmake_dataset( gid, dset, 2, dim, H5T_NATIVE_UINT16, img->calib, 6 );
+	}
+	if(r<0) goto err_out;
+
+	/* add attributes, which are required to unpack the values */
+	r = H5LTset_attribute_double(gid, dset, "scale_factor", &scale, 1);
+	if(r<0) goto err_out;
+	r = H5LTset_attribute_double(gid, dset, "add_offset", &offset, 1);
+	if(r<0) goto err_out;
+	r = H5LTset_attribute_ushort(gid, dset, "_FillValue", &fill, 1);
+	if(r<0) goto err_out;
+	r = H5LTset_attribute_ushort(gid, dset, "channel_id", &img->channel_id, 1);
+	if(r<0) goto err_out;
+	r = H5LTset_attribute_string(gid, dset, "units", thermal ? "K" : "1" );
+	if(r<0) goto err_out;
+	snprintf( long_name, 64, "%s_%s",
+		  thermal ? "toa_brightness_temperature" : "toa_bidirectional_reflectance",
+		  msevi_id2chan(img->channel_id) );
+	r = H5LTset_attribute_string(gid, dset, "long_name",  long_name );
+	if(r<0) goto err_out;
+
+	return 0;
+
+err_out:
+	return -1;
+}
+
 /* read MSG SEIVIR image */
 struct msevi_l15_image *msevi_l15hdf_read_image( hid_t fid, int chan_id )
 {
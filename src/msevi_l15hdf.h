@@ -10,6 +10,7 @@ extern const char *msevi_l15hdf_meta_grp;
 extern const char *msevi_l15hdf_lsi_grp;
 
 int msevi_l15hdf_write_image( hid_t gid, struct msevi_l15_image *img );
+int msevi_l15hdf_write_calibrated( hid_t gid, struct msevi_l15_image *img );
 struct msevi_l15_image *msevi_l15hdf_read_image( hid_t gid, int chanid );
 
 int msevi_l15hdf_write_line_side_info( hid_t lsi_gid, struct msevi_l15_image *img );
@@ -6,15 +6,21 @@
 #include <time.h>
 #include <endian.h>
 #include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 #include <glob.h>
-#include <libgen.h>
+#include <fnmatch.h>
 
 /* Local includes */
 #include "memcpy_endian.h"
 #include "cds_time.h"
 #include "fileutils.h"
+#include "tarutils.h"
 #include "mathutils.h"
+#include "memutils.h"
+#include "msevi_l15cache.h"
 #include "timeutils.h"
 #include "cgms_xrit.h"
 #include "msevi_l15data.h"
@@ -50,6 +56,19 @@ const static size_t header_rec_off[9] = {
         445247  /* end */
 };
 
+/* number of leading bytes of the header records decoded by
+   msevi_l15hrit_read_prologue_records(), zero for records not decoded */
+const static size_t header_rec_used[8] = {
+	      0, /* version */
+	  39647, /* satellite_status, up to the last orbit coefficients */
+	     26, /* image_acquisition */
+	      0, /* celestial_events */
+	    101, /* image_description */
+	    264, /* radiometric_processing, up to the calibration */
+	    361, /* geometric_processing, up to the earth model */
+	      0  /* impf_configuration */
+};
+
 /* SEVIRI L15 trailer record lengths */
 const static size_t trailer_rec_len[7] = {
 	     1, /* version */
@@ -72,22 +91,126 @@ const static size_t trailer_rec_off[8] = {
         390325  /* end */
 };
 
+/* number of threads decoding the segments of an image */
+static int decode_nthreads = 1;
+
+/* maximum number of threads mapping the lines of one segment, and
+   minimum number of lines mapped by each */
+#define MAP_MAX_THREADS  16
+#define MAP_MIN_LINES    32
+
+/* tile size of the images read, 0 for row-major images */
+static int image_tile_nlin = 0;
+static int image_tile_ncol = 0;
+
+/* per-channel tables of calibrated values applied while mapping the
+   segments of the images read, see msevi_l15hrit_set_calib() */
+static const uint16_t *image_calib_lut[MSEVI_NCHAN+1];
+
+/* directory and size limit of the segment and prologue cache */
+static char  *cache_dir = NULL;
+static size_t cache_max_size = 0;
+
+/**
+ * \brief  Parse a SEVIRI L15 HRIT file name
+ *
+ * File names follow the pattern
+ * H-000-MSG1__-MSG1________-CHANNEL__-SEGMENT__-YYYYMMDDHHMM-C_, with
+ * PRO/EPI as segment for the prologue/epilogue files. Image segments are
+ * numbered from 1 to MSEVI_NSEG.
+ *
+ * \param[in]  fnam   the file name, optionally including a directory
+ * \param[out] fn     the decoded file name information
+ *
+ * \return     0 on success, or -1 if fnam is not a SEVIRI L15 HRIT file name
+ */
+int msevi_l15hrit_parse_fname( char *fnam, struct msevi_l15hrit_fname *fn )
+{
+	char *bnam;
+	char chanstr[7], segstr[7], timestr[13];
+
+	/* get basename */
+	bnam = strrchr( fnam, '/' );
+	bnam = (bnam==NULL) ? fnam : bnam+1;
+	if( strncmp(bnam, "H-000-MSG", 9)!=0 || strlen(bnam)<58 ) return -1;
+
+	/* get channel/segment/time substrings */
+	strncpy( chanstr, bnam+26, 6 );
+	chanstr[6]=0;
+	strncpy( segstr, bnam+36, 6 );
+	segstr[6]=0;
+	strncpy( timestr, bnam+46, 12 );
+	timestr[12]=0;
+
+	if( parse_utc_timestr( timestr, "%Y%m%d%H%M", &fn->time )<0 ) return -1;
+	fn->rss = ( strstr(bnam, "RSS")!=NULL );
+
+	if( strncasecmp(segstr,"PRO",3)==0 ) {
+		fn->ftype      = MSEVI_L15HRIT_PROLOGUE;
+		fn->channel_id = 0;
+		fn->segment    = 0;
+	} else if( strncasecmp(segstr,"EPI",3)==0 ) {
+		fn->ftype      = MSEVI_L15HRIT_EPILOGUE;
+		fn->channel_id = 0;
+		fn->segment    = 0;
+	} else {
+		fn->ftype      = XRIT_FTPYE_IMAGE;
+		fn->channel_id = msevi_chan2id(chanstr);
+		fn->segment    = atoi(segstr);
+		if( fn->channel_id<1 || fn->segment<1 || fn->segment>MSEVI_NSEG ) return -1;
+	}
+	return 0;
+}
+
+/* add a file to a file list, based on its name */
+static void flist_add( struct msevi_l15hrit_flist *flist, char *file )
+{
+	int ichan, iseg;
+	struct msevi_l15hrit_fname fn;
+	char *fnam;
+
+	/* get channel/segment from file name */
+	if( msevi_l15hrit_parse_fname(file, &fn)<0 ) return;
+	fnam = strdup( file );
+
+	if( fn.ftype==MSEVI_L15HRIT_PROLOGUE ) {
+		free( flist->prologue );
+		flist->prologue = fnam;
+	} else if( fn.ftype==MSEVI_L15HRIT_EPILOGUE ) {
+		free( flist->epilogue );
+		flist->epilogue = fnam;
+	} else {
+		ichan = fn.channel_id;
+		iseg = flist->nseg[ichan-1];
+		if( iseg>=MSEVI_NSEG+2 ) {
+			free(fnam);
+			return;
+		}
+		flist->channel[ichan-1][iseg] = fnam;
+		flist->nseg[ichan-1]++;
+	}
+	return;
+}
 
 /**
  * \brief  Return a list of SEVIRI L15 HRIT files for one repeat cycle
  *
- * \param[in]  dir    the directory to search in
+ * The files are searched in a directory, or in an uncompressed tar archive.
+ * Files in a tar archive are named "archive.tar/member", and can be opened
+ * by xrit_mopen() directly from the archive.
+ *
+ * \param[in]  dir    the directory or tar archive to search in
  * \param[in]  time   the time of the repeat cycle
  *
  * \return     the list of SEVIRI L15 image files
  */
 struct msevi_l15hrit_flist *msevi_l15hrit_get_flist( char *dir, time_t *time, char *svc )
 {
-	int i, r;
-	int ichan, iseg;
+	int i;
 	struct msevi_l15hrit_flist *flist;
-	char *fnam, *bnam, *tnam;
-	char timestr[16], pattern[512], chanstr[7], segstr[7];
+	struct tar_index *ti;
+	char *bnam;
+	char timestr[16], pattern[512], path[PATH_MAX];
 	glob_t globbuf = {};
 
 	/* allocate memory for return structure */
@@ -97,43 +220,37 @@ struct msevi_l15hrit_flist *msevi_l15hrit_get_flist( char *dir, time_t *time, ch
 	/* match SEVIRI HRIT files */
 	snprint_utc_timestr( timestr, 16, "%Y%m%d%H%M", *time );
 	if (0==strncasecmp(svc,"pzs",3)) {
-		snprintf( pattern, 512, "%s/H-000-MSG*%s*", dir, timestr );
+		snprintf( pattern, 512, "H-000-MSG*%s*", timestr );
 	}else if (0==strncasecmp(svc,"rss",3)) {
-		snprintf( pattern, 512, "%s/H-000-MSG*RSS*%s*", dir, timestr );
+		snprintf( pattern, 512, "H-000-MSG*RSS*%s*", timestr );
 	} else {
 		printf("ERROR: unknown service %s\nExiting\n", svc);
 		exit(-1);
 	}
-	globbuf.gl_offs = 0;
-	r = glob( pattern, 0, NULL, &globbuf );
-
-	for( i=0; i<globbuf.gl_pathc; i++ ) {
 
-		/* get basename */
-		fnam = strdup( globbuf.gl_pathv[i] );
-		tnam = strdup(fnam);
-		bnam = basename( tnam );
-
-		/* get channel/segment substrings */
-		strncpy( chanstr, bnam+26, 6 );
-		chanstr[6]=0;
-		strncpy( segstr, bnam+36, 6 );
-		segstr[6]=0;
-		free(tnam);
-
-		if( strncasecmp(segstr,"PRO",3)==0 ) {
-			flist->prologue = fnam;
-		} else if( strncasecmp(segstr,"EPI",3)==0 ) {
-			flist->epilogue = fnam;
-		} else {
-			ichan = msevi_chan2id(chanstr);
-			iseg = flist->nseg[ichan-1];
-			flist->channel[ichan-1][iseg] = fnam;
-			flist->nseg[ichan-1]++;
+	if( is_tar_file(dir) ) {
+		ti = tar_index_open( dir );
+		if( ti==NULL ) {
+			free( flist );
+			goto err_out;
 		}
+		for( i=0; i<ti->nmemb; i++ ) {
+			bnam = strrchr( ti->memb[i].name, '/' );
+			bnam = (bnam==NULL) ? ti->memb[i].name : bnam+1;
+			if( fnmatch(pattern, bnam, 0)!=0 ) continue;
+			snprintf( path, PATH_MAX, "%s/%s", dir, ti->memb[i].name );
+			flist_add( flist, path );
+		}
+		tar_index_free( ti );
+	} else {
+		snprintf( path, PATH_MAX, "%s/%s", dir, pattern );
+		globbuf.gl_offs = 0;
+		glob( path, 0, NULL, &globbuf );
+		for( i=0; i<globbuf.gl_pathc; i++ ) {
+			flist_add( flist, globbuf.gl_pathv[i] );
+		}
+		globfree( &globbuf );
 	}
-
-	globfree( &globbuf );
 	return flist;
 
 err_out:
@@ -154,7 +271,7 @@ void msevi_l15hrit_free_flist( struct msevi_l15hrit_flist *fl )
 	if( fl ) {
 		free(fl->prologue);
 		free(fl->epilogue);
-		for( ichan=0; ichan<MSEVI_NCHAN-1; ichan++ ) {
+		for( ichan=0; ichan<MSEVI_NCHAN; ichan++ ) {
 			for( iseg=0; iseg<fl->nseg[ichan]; iseg++ ) {
 				free( fl->channel[ichan][iseg] );
 			}
@@ -164,225 +281,1167 @@ void msevi_l15hrit_free_flist( struct msevi_l15hrit_flist *fl )
 	return;
 }
 
-struct msevi_l15_image *msevi_l15hrit_read_segment( char *fnam )
+static int coverage_overlaps ( struct msevi_l15_coverage *c1,
+			       struct msevi_l15_coverage *c2 )
+{
+	if(     c1->southern_line  > c2->northern_line
+	     || c1->northern_line  < c2->southern_line
+	     || c1->eastern_column > c2->western_column
+             || c1->western_column < c2->eastern_column )
+		return 0;
+	return 1;
+}
+
+/**
+ * \brief  Select the segment files of a channel overlapping a coverage
+ *
+ * Segments with unknown coverage are always selected, and have to be
+ * tested when the file is opened.
+ *
+ * \param[in]  fl       the file list
+ * \param[in]  chan_id  the channel id
+ * \param[in]  cov      the requested coverage
+ * \param[out] files    the selected file names, with room for
+ *                      MSEVI_NSEG+2 entries
+ *
+ * \return     the number of selected files
+ */
+int msevi_l15hrit_select_segments( struct msevi_l15hrit_flist *fl, int chan_id,
+				   struct msevi_l15_coverage *cov, char **files )
+{
+	int iseg, n=0;
+	struct msevi_l15_coverage *seg_cov;
+
+	for( iseg=0; iseg<fl->nseg[chan_id-1]; iseg++ ) {
+		seg_cov = &fl->coverage[chan_id-1][iseg];
+		if( seg_cov->northern_line==0 || coverage_overlaps(cov, seg_cov) ) {
+			files[n++] = fl->channel[chan_id-1][iseg];
+		}
+	}
+	return n;
+}
+
+/**
+ * \brief  Open a SEVIRI L15 HRIT image segment
+ *
+ * The file is mapped and the header records needed for coverage queries
+ * are decoded once, so that the segment can be tested for overlap and
+ * decoded later on without re-opening the file.
+ *
+ * \param[in]  fnam   the segment file name
+ *
+ * \return     the segment handle, or NULL on failure
+ */
+struct msevi_l15hrit_segment *msevi_l15hrit_open_segment( char *fnam )
 {
 	struct xrit_file *xf;
-	void *hdr, *hrec, *data;
-	struct xrit_hrec_primary *prim;
-	struct xrit_hrec_image_structure  *img_struct;
-	struct xrit_hrec_image_navigation *img_nav;
-	struct msevi_hrec_segment_identification *seg_id;
-	struct msevi_hrec_segment_line_quality *line_qual;
+	struct msevi_l15hrit_segment *seg;
+
+	xf = xrit_mopen(fnam);
+	if(xf==NULL) return NULL;
+	seg = msevi_l15hrit_attach_segment(xf);
+	if(seg==NULL) return NULL;
+	seg->fnam = strdup(fnam);
+	if(seg->fnam==NULL) {
+		msevi_l15hrit_close_segment(seg);
+		return NULL;
+	}
+	return seg;
+}
+
+/**
+ * \brief  Attach a segment handle to an opened XRIT file
+ *
+ * This allows to decode segments held in memory, see xrit_open_mem().
+ *
+ * \param[in]  xf     the XRIT file, opened by xrit_mopen() or xrit_open_mem().
+ *                    It is owned by the segment handle afterwards, also if
+ *                    the function fails.
+ *
+ * \return     the segment handle, or NULL on failure
+ */
+struct msevi_l15hrit_segment *msevi_l15hrit_attach_segment( struct xrit_file *xf )
+{
+	struct msevi_l15hrit_segment *seg;
+	struct msevi_l15_coverage *cov;
+	const uint32_t required = MSEVI_L15HRIT_HAS_IMAGE_STRUCTURE
+		| MSEVI_L15HRIT_HAS_IMAGE_NAVIGATION | MSEVI_L15HRIT_HAS_SEGMENT_ID;
+	int base;
+
+	seg = calloc(1,sizeof(*seg));
+	if(seg==NULL) {
+		xrit_fclose(xf);
+		goto err_out;
+	}
+
+	/* check that the file is an image */
+	seg->xf = xf;
+	if( seg->xf->ftype!=XRIT_FTPYE_IMAGE ) goto err_out;
+	if( xrit_get_header(seg->xf)==NULL ) goto err_out;
+
+	/* decode all header records in a single pass */
+	if( msevi_l15hrit_parse_header( xrit_get_header(seg->xf), seg->xf->header_len,
+					&seg->hdr )<0 ) goto err_out;
+	if( (seg->hdr.found & required)!=required ) goto err_out;
+
+	/* calculate coverage, special-casing HRV */
+	base = (seg->hdr.seg_id.channel_id==MSEVI_CHAN_HRV) ? MSEVI_HRV_OFF : MSEVI_VISIR_OFF;
+	cov = &seg->coverage;
+	cov->southern_line  = base-seg->hdr.img_nav.loff+1;
+	cov->northern_line  = cov->southern_line+seg->hdr.img_struct.nlin-1;
+	cov->eastern_column = base-seg->hdr.img_nav.coff+1;
+	cov->western_column = cov->eastern_column+seg->hdr.img_struct.ncol-1;
+
+	return seg;
+
+ err_out:
+	msevi_l15hrit_close_segment(seg);
+	return NULL;
+}
+
+/**
+ * \brief  Close a SEVIRI L15 HRIT image segment
+ *
+ * \param[in]  seg    the segment handle, may be NULL
+ *
+ * \return     nothing
+ */
+void msevi_l15hrit_close_segment( struct msevi_l15hrit_segment *seg )
+{
+	if( seg ) {
+		if( seg->xf ) xrit_fclose(seg->xf);
+		free(seg->fnam);
+		free(seg);
+	}
+	return;
+}
+
+/*
+ * Decode the counts of the segment lines [*first,*first+*n). Uncompressed
+ * segments are unpacked for the requested lines only, compressed segments
+ * are decoded as a whole, in which case *first and *n are set to the
+ * decoded range.
+ */
+static uint16_t *decode_counts( struct msevi_l15hrit_segment *seg, int *first, int *n )
+{
+	struct xrit_file *xf = seg->xf;
+	struct xrit_hrec_image_structure *is = &seg->hdr.img_struct;
+	uint16_t *counts;
+	void *data;
+
+	/* uncompress data directly from the mapping */
+	data = xrit_get_data(xf);
+	if(data==NULL) return NULL;
+	if( is->compression>0 ) {
+		*first = 0;
+		*n     = is->nlin;
+		return xrit_data_decompress( is->nlin, is->ncol, is->bpp, 3,
+					     data, xf->data_len );
+	}
+
+	/* uncompressed data, clip the line range to the segment */
+	if( *first<0 ) *first = 0;
+	if( *first+*n>is->nlin ) *n = is->nlin-*first;
+	if( *n<=0 ) return NULL;
+	if( xf->data_len<(uint64_t)is->nlin*is->ncol*is->bpp ) return NULL;
+
+	counts = malloc( (size_t)*n*is->ncol*sizeof(uint16_t) );
+	if(counts==NULL) return NULL;
+	switch( is->bpp ) {
+	case 10:
+		unpack_10bit_to_16bit( data, counts, (size_t)*first*is->ncol,
+				       (size_t)*n*is->ncol );
+		break;
+	case 16:
+		memcpy_be16toh( counts, data+(size_t)*first*is->ncol*2,
+				(size_t)*n*is->ncol );
+		break;
+	default:
+		free(counts);
+		return NULL;
+	}
+	return counts;
+}
+
+/**
+ * \brief  Decode the image data of an open SEVIRI L15 HRIT segment
+ *
+ * \param[in]  seg    the segment handle
+ *
+ * \return     the segment image, or NULL on failure
+ */
+struct msevi_l15_image *msevi_l15hrit_decode_segment( struct msevi_l15hrit_segment *seg )
+{
 	struct msevi_l15_image *img;
+	int first, n;
 
-	/* open file and check that it is an image */
-	xf  = xrit_fopen(fnam, "rb");
-	if( xf==NULL || xf->ftype!=XRIT_FTPYE_IMAGE ) goto err_out;
-
-	/* read relevant header records */
-	hdr = xrit_read_header(xf);
-	if(hdr==NULL) goto err_out;
-	hrec = xrit_find_hrec(hdr, xf->header_len, XRIT_HREC_PRIMARY);
-	prim = xrit_decode_hrec(hrec);
-	hrec = xrit_find_hrec(hdr, xf->header_len, XRIT_HREC_IMAGE_STRUCTURE);
-	img_struct = xrit_decode_hrec(hrec);
-	hrec = xrit_find_hrec(hdr, xf->header_len, XRIT_HREC_IMAGE_NAVIGATION);
-	img_nav = xrit_decode_hrec(hrec);
-	hrec = xrit_find_hrec(hdr, xf->header_len, MSEVI_HREC_SEGMENT_IDENTIFICATION );
-	seg_id = msevi_l15hrit_decode_hrec(hrec);
-	hrec = xrit_find_hrec(hdr, xf->header_len, MSEVI_HREC_SEGMENT_LINE_QUALITY);
-	line_qual = msevi_l15hrit_decode_hrec(hrec);
+	if( !(seg->hdr.found & MSEVI_L15HRIT_HAS_LINE_QUALITY) ) return NULL;
 
 	/* allocate image */
 	img = calloc(1,sizeof(*img));
 	if(img==NULL) goto err_out;
 
 	/* set image information */
-	img->nlin = img_struct->nlin;
-	img->ncol = img_struct->ncol;
-	img->depth = img_struct->bpp;
-
-	if( seg_id->channel_id==12 ) {
-		img->coverage.southern_line = 5566-img_nav->loff+1;
-		img->coverage.northern_line = img->coverage.southern_line+img->nlin-1;
-		img->coverage.eastern_column = 5566-img_nav->coff+1;
-		img->coverage.western_column = img->coverage.eastern_column+img->ncol-1;
-	}else {
-		img->coverage.southern_line = 1856-img_nav->loff+1;
-		img->coverage.northern_line = img->coverage.southern_line+img->nlin-1;
-		img->coverage.eastern_column = 1856-img_nav->coff+1;
-		img->coverage.western_column = img->coverage.eastern_column+img->ncol-1;
-	}
-	img->channel_id = seg_id->channel_id;
-	img->spacecraft_id = seg_id->sat_id;
-	img->line_side_info = line_qual->line_side_info;
-	// printf("lfac=%d cfac=%d\n", img_nav->lfac, img_nav->cfac );
-
-	/* read and uncompress data */
-	data = xrit_read_data(xf);
-	if( img_struct->compression>0 ) {
-		img->counts = xrit_data_decompress( img->nlin, img->ncol,
-						    img->depth, 3, data,
-						    xf->data_len );
-		/* free(data); ?? Why no free ?? */
+	img->nlin = seg->hdr.img_struct.nlin;
+	img->ncol = seg->hdr.img_struct.ncol;
+	img->depth = seg->hdr.img_struct.bpp;
+	memcpy( &img->coverage, &seg->coverage, sizeof(struct msevi_l15_coverage) );
+	img->channel_id = seg->hdr.seg_id.channel_id;
+	img->spacecraft_id = seg->hdr.seg_id.sat_id;
+
+	/* decode line side information */
+	img->line_side_info = calloc(img->nlin, sizeof(*img->line_side_info));
+	if(img->line_side_info==NULL) goto err_out;
+	msevi_l15hrit_decode_line_quality( &seg->hdr, 0, img->nlin, 1,
+					   img->line_side_info );
+
+	first = 0;
+	n = img->nlin;
+	img->counts = decode_counts(seg, &first, &n);
+	if(img->counts==NULL) goto err_out;
+
+	return img;
+
+ err_out:
+	msevi_l15_image_free(img);
+	return NULL;
+}
+
+struct msevi_l15_image *msevi_l15hrit_read_segment( char *fnam )
+{
+	struct msevi_l15hrit_segment *seg;
+	struct msevi_l15_image *img;
+
+	seg = msevi_l15hrit_open_segment(fnam);
+	if(seg==NULL) return NULL;
+	img = msevi_l15hrit_decode_segment(seg);
+	msevi_l15hrit_close_segment(seg);
+	return img;
+}
+
+/*
+ * Look up the calibrated values of n counts just written to the
+ * destination, while they are still in the cache.
+ */
+static inline void calib_line( const uint16_t *lut, const uint16_t *cnt, uint16_t *cal,
+			       int n )
+{
+	int i;
+
+	for( i=0; i<n; i++ ) cal[i] = lut[cnt[i]&(MSEVI_L15_NCOUNT-1)];
+	return;
+}
+
+/*
+ * Copy nlin lines of ncol counts reversed, proceeding southwards in the
+ * destination and northwards in the source, and look up their calibrated
+ * values in cal if lut is not NULL. The function is inlined with the
+ * source line length as constant for VIS/IR and HRV segments.
+ */
+static inline __attribute__((always_inline))
+void copy_lines_rev( uint16_t *cdest, size_t dest_ncol, const uint16_t *csrc,
+		     const size_t src_ncol, int nlin, int ncol,
+		     const uint16_t *lut, uint16_t *cal )
+{
+	int il;
+
+	for( il=0; il<nlin; il++ ) {
+		memcpy_rev16( cdest, csrc, ncol );
+		if( lut ) {
+			calib_line( lut, cdest, cal, ncol );
+			cal += dest_ncol;
+		}
+		cdest += dest_ncol;
+		csrc  -= src_ncol;
+	}
+	return;
+}
+
+/*
+ * Map the decoded segment lines [first,...) in counts to the destination,
+ * flipping them north/south and east/west. If counts is NULL, the lines
+ * are unpacked from the packed 10-bit data of an uncompressed segment
+ * straight to their position in the destination. Only the image lines
+ * [lo,hi] are written. The calibrated values of images with a calibration
+ * table are written in the same pass.
+ */
+static int map_segment(struct msevi_l15_image *dest, struct msevi_l15hrit_segment *seg,
+		       uint16_t *counts, int first, int lo, int hi)
+{
+	int il, ic, m, nlin, ncol, dcol;
+	int south_lin, north_lin, east_col, west_col;
+	int loff_dest, loff_src;
+	struct msevi_l15_coverage *src_cov = &seg->coverage;
+	uint16_t *csrc, *cdest, *cal;
+	const uint16_t *lut;
+	void *packed = NULL;
+	size_t soff, src_ncol;
+
+	/* calibrated values are looked up right after writing the counts */
+	lut = dest->calib ? dest->calib_lut : NULL;
+
+	if( counts==NULL ) {
+		packed = xrit_get_data( seg->xf );
+		if( packed==NULL ) return -1;
+	}
+
+	south_lin = MAX(dest->coverage.southern_line, src_cov->southern_line);
+	north_lin = MIN(dest->coverage.northern_line, src_cov->northern_line);
+	east_col  = MAX(dest->coverage.eastern_column, src_cov->eastern_column);
+	west_col  = MIN(dest->coverage.western_column, src_cov->western_column);
+	south_lin = MAX(south_lin, lo);
+	north_lin = MIN(north_lin, hi);
+
+	nlin = north_lin-south_lin+1;
+	ncol = west_col-east_col+1;
+	if(nlin<0||ncol<0) return 0; /* no overlap of regions */
+
+	/* decode line side information straight into the destination, the
+	   northern-most overlapping line first */
+	loff_dest = dest->coverage.northern_line-north_lin;
+	loff_src  = south_lin-src_cov->southern_line+nlin-1;
+	msevi_l15hrit_decode_line_quality( &seg->hdr, loff_src, nlin, -1,
+					   dest->line_side_info+loff_dest );
+
+	/* offset of the eastern-most overlapping pixel of the northern-most
+	   source line */
+	src_ncol = seg->hdr.img_struct.ncol;
+	soff = (size_t)loff_src*src_ncol + east_col-src_cov->eastern_column;
+	dcol = dest->coverage.western_column-west_col;
+
+	if( dest->tile_nlin>0 ) {
+		/* tiled destination, copy the part of each line within a tile,
+		   destination columns [ic,ic+m) take the source columns
+		   [ncol-ic-m,ncol-ic) reversed */
+		for( il=0; il<nlin; il++ ) {
+			for( ic=0; ic<ncol; ic+=m ) {
+				m = dest->tile_ncol-(dcol+ic)%dest->tile_ncol;
+				if( m>ncol-ic ) m = ncol-ic;
+				cdest = msevi_l15_image_pixel( dest, loff_dest+il, dcol+ic );
+				if( packed ) {
+					unpack_10bit_to_16bit_rev( packed, cdest, soff+ncol-ic-m, m );
+				} else {
+					csrc = counts + soff-(size_t)first*src_ncol + ncol-ic-m;
+					memcpy_rev16( cdest, csrc, m );
+				}
+				if( lut ) {
+					calib_line( lut, cdest, dest->calib+(cdest-dest->counts), m );
+				}
+			}
+			soff -= src_ncol;
+		}
+	} else if( packed ) {
+		/* unpack source lines reversed */
+		cdest = dest->counts + (size_t)loff_dest*dest->ncol + dcol;
+		for( il=0; il<nlin; il++ ) {
+			unpack_10bit_to_16bit_rev( packed, cdest, soff, ncol );
+			if( lut ) {
+				calib_line( lut, cdest, dest->calib+(cdest-dest->counts), ncol );
+			}
+			cdest += dest->ncol;
+			soff  -= src_ncol;
+		}
 	} else {
-		img->counts = data;
+		/* get source and destination pointers of the northern-most line,
+		   and write counts */
+		cdest = dest->counts + (size_t)loff_dest*dest->ncol + dcol;
+		csrc  = counts + soff-(size_t)first*src_ncol;
+		cal   = lut ? dest->calib+(cdest-dest->counts) : NULL;
+		switch( src_ncol ) {
+		case MSEVI_VISIR_NCOL:
+			copy_lines_rev( cdest, dest->ncol, csrc, MSEVI_VISIR_NCOL, nlin, ncol,
+					lut, cal );
+			break;
+		case MSEVI_HRV_NCOL:
+			copy_lines_rev( cdest, dest->ncol, csrc, MSEVI_HRV_NCOL, nlin, ncol,
+					lut, cal );
+			break;
+		default:
+			copy_lines_rev( cdest, dest->ncol, csrc, src_ncol, nlin, ncol,
+					lut, cal );
+			break;
+		}
+	}
+	if( dest->spacecraft_id == 0 ) {
+		dest->spacecraft_id = seg->hdr.seg_id.sat_id;
+		dest->channel_id = seg->hdr.seg_id.channel_id;
+	}
+	return nlin;
+}
+
+
+int msevi_l15hrit_get_segment_coverage( char *fnam, struct msevi_l15_coverage *cov )
+{
+	struct msevi_l15hrit_segment *seg;
+
+	seg = msevi_l15hrit_open_segment(fnam);
+	if(seg==NULL) return -1;
+	memcpy( cov, &seg->coverage, sizeof(struct msevi_l15_coverage) );
+	msevi_l15hrit_close_segment(seg);
+	return 0;
+}
+
+/* a group of image lines of a segment, mapped by one thread */
+struct map_group {
+	struct msevi_l15_image **img;
+	int nimg;
+	struct msevi_l15hrit_segment *seg;
+	uint16_t *counts;
+	int first;
+	int lo, hi;
+	int nlin;
+};
+
+static void *map_group_worker( void *arg )
+{
+	struct map_group *g = arg;
+	int k, r;
+
+	g->nlin = 0;
+	for( k=0; k<g->nimg; k++ ) {
+		if( !coverage_overlaps(&g->img[k]->coverage, &g->seg->coverage) ) continue;
+		r = map_segment( g->img[k], g->seg, g->counts, g->first, g->lo, g->hi );
+		if( r<0 ) {
+			g->nlin = -1;
+			break;
+		}
+		g->nlin += r;
+	}
+	return NULL;
+}
+
+/*
+ * Map decoded counts of the segment lines [first,...) to all overlapping
+ * images. With nthreads>1, the overlapping lines are split into groups
+ * mapped in parallel, which write disjoint image lines.
+ */
+static int map_segment_images( struct msevi_l15_image **img, int nimg,
+			       struct msevi_l15hrit_segment *seg,
+			       uint16_t *counts, int first, int nthreads )
+{
+	int i, k, lo = INT_MAX, hi = INT_MIN, ngrp, nlin = 0;
+	struct map_group grp[MAP_MAX_THREADS];
+	pthread_t threads[MAP_MAX_THREADS];
+	int started[MAP_MAX_THREADS];
+
+	/* range of the lines overlapping any of the images */
+	for( k=0; k<nimg; k++ ) {
+		if( !coverage_overlaps(&img[k]->coverage, &seg->coverage) ) continue;
+		lo = MIN(lo, (int)MAX(img[k]->coverage.southern_line, seg->coverage.southern_line));
+		hi = MAX(hi, (int)MIN(img[k]->coverage.northern_line, seg->coverage.northern_line));
+	}
+	if( hi<lo ) return 0;
+
+	ngrp = MIN(MIN(nthreads, MAP_MAX_THREADS), (hi-lo+1)/MAP_MIN_LINES);
+	if( ngrp<1 ) ngrp = 1;
+	for( i=0; i<ngrp; i++ ) {
+		grp[i].img    = img;
+		grp[i].nimg   = nimg;
+		grp[i].seg    = seg;
+		grp[i].counts = counts;
+		grp[i].first  = first;
+		grp[i].lo     = lo + (long)(hi-lo+1)*i/ngrp;
+		grp[i].hi     = lo + (long)(hi-lo+1)*(i+1)/ngrp - 1;
+	}
+
+	/* the calling thread maps the first group, and those no thread
+	   could be started for */
+	for( i=1; i<ngrp; i++ ) {
+		started[i] = pthread_create( threads+i, NULL, map_group_worker, grp+i )==0;
+		if( !started[i] ) map_group_worker( grp+i );
+	}
+	map_group_worker( grp );
+	for( i=0; i<ngrp; i++ ) {
+		if( i>0 && started[i] ) pthread_join( threads[i], NULL );
+		if( grp[i].nlin<0 ) nlin = -1;
+		if( nlin>=0 ) nlin += grp[i].nlin;
+	}
+	return nlin;
+}
+
+/*
+ * Map a compressed segment into the images, taking the decompressed counts
+ * from the segment cache if available, and adding them to the cache
+ * otherwise. Caching is best effort, the segment is decoded as usual if
+ * the cache can not be read or written.
+ */
+static int add_cached_segment( struct msevi_l15_image **img, int nimg,
+			       struct msevi_l15hrit_segment *seg, int nthreads )
+{
+	int nlin, first = 0, n = 0;
+	uint64_t key;
+	uint16_t *counts;
+	struct xrit_file *xf = seg->xf;
+	struct xrit_hrec_image_structure *is = &seg->hdr.img_struct;
+	struct msevi_l15cache_entry e;
+
+	key = msevi_l15cache_key( seg->fnam, xrit_get_header(xf), xf->header_len,
+				  xf->data_len );
+	if( msevi_l15cache_get(cache_dir, key, is->nlin, is->ncol, &e)==0 ) {
+		nlin = map_segment_images( img, nimg, seg, e.data, 0, nthreads );
+		msevi_l15cache_release( &e );
+		return nlin;
+	}
+
+	counts = decode_counts( seg, &first, &n );
+	if(counts==NULL) return -1;
+	msevi_l15cache_put( cache_dir, cache_max_size, key, is->nlin, is->ncol, counts );
+	nlin = map_segment_images( img, nimg, seg, counts, first, nthreads );
+	free( counts );
+	return nlin;
+}
+
+/*
+ * Decode a segment into several images, see msevi_l15hrit_add_segment_multi(),
+ * mapping groups of lines by up to nthreads threads. Compressed segments are
+ * decompressed by a single call of the wavelet library, only the mapping of
+ * the decompressed counts is split.
+ */
+static int add_segment_threads( int nimg, struct msevi_l15_image **img,
+				struct msevi_l15hrit_segment *seg, int nthreads )
+{
+	int k, nlin, first = INT_MAX, last = -1, n, s, l;
+	uint16_t *counts;
+	struct msevi_l15_coverage *cov;
+	struct xrit_hrec_image_structure *is = &seg->hdr.img_struct;
+
+	/* range of segment lines overlapping any of the images */
+	for( k=0; k<nimg; k++ ) {
+		cov = &img[k]->coverage;
+		if( !coverage_overlaps(cov, &seg->coverage) ) continue;
+		s = MAX(cov->southern_line, seg->coverage.southern_line)
+			- seg->coverage.southern_line;
+		l = MIN(cov->northern_line, seg->coverage.northern_line)
+			- seg->coverage.southern_line;
+		first = MIN(first, s);
+		last  = MAX(last, l);
+	}
+	if( last<0 ) return 0;
+
+	/* unpack uncompressed segments in place */
+	if( is->compression==0 && is->bpp==10 ) {
+		if( seg->xf->data_len<(uint64_t)is->nlin*is->ncol*is->bpp ) return -1;
+		return map_segment_images( img, nimg, seg, NULL, 0, nthreads );
+	}
+	if( is->compression>0 && cache_dir!=NULL )
+		return add_cached_segment( img, nimg, seg, nthreads );
+
+	/* decode the overlapping segment lines only, if possible */
+	n = last-first+1;
+	counts = decode_counts( seg, &first, &n );
+	if(counts==NULL) return -1;
+	nlin = map_segment_images( img, nimg, seg, counts, first, nthreads );
+	free( counts );
+	return nlin;
+}
+
+/**
+ * \brief  Decode a SEVIRI L15 HRIT segment into several images
+ *
+ * The segment is decoded once, and the parts overlapping the coverage of
+ * each image are written to the image. Segments without overlap are not
+ * decoded. Uncompressed 10-bit segments are unpacked straight into the
+ * images, without a temporary buffer.
+ *
+ * \param[in]  nimg   the number of destination images
+ * \param[in]  img    the destination images, e.g. covering different regions
+ * \param[in]  seg    the segment handle
+ *
+ * \return     the total number of image lines written, or -1 on failure
+ */
+int msevi_l15hrit_add_segment_multi( int nimg, struct msevi_l15_image **img,
+				     struct msevi_l15hrit_segment *seg )
+{
+	return add_segment_threads( nimg, img, seg, 1 );
+}
+
+/**
+ * \brief  Decode a SEVIRI L15 HRIT segment into an image
+ *
+ * Only the part of the segment overlapping the image coverage is written to
+ * the image, see msevi_l15hrit_add_segment_multi().
+ *
+ * \param[in]  img    the destination image
+ * \param[in]  seg    the segment handle
+ *
+ * \return     the number of image lines written, or -1 on failure
+ */
+int msevi_l15hrit_add_segment( struct msevi_l15_image *img,
+			       struct msevi_l15hrit_segment *seg )
+{
+	return msevi_l15hrit_add_segment_multi( 1, &img, seg );
+}
+
+/* decoding of the segments of an image by a pool of workers */
+struct decode_job {
+	struct msevi_l15_image **img;
+	int nimg;
+	struct msevi_l15hrit_segment **seg;
+	struct xrit_batch *batch;
+	int n;
+	int seg_nthreads;   /* threads mapping the lines of each segment */
+	int next;
+	int err;
+	pthread_mutex_t lock;
+};
+
+static void *decode_worker( void *arg )
+{
+	struct decode_job *job = arg;
+	int i, r;
+
+	for(;;) {
+		pthread_mutex_lock( &job->lock );
+		i = job->err ? job->n : job->next++;
+		pthread_mutex_unlock( &job->lock );
+		if( i>=job->n ) break;
+
+		/* segments map to disjoint lines of the image, so no locking
+		   is needed for decoding */
+		r = xrit_batch_wait( job->batch, i );
+		if( r==0 ) r = add_segment_threads( job->nimg, job->img, job->seg[i],
+						    job->seg_nthreads );
+		if( r<0 ) {
+			pthread_mutex_lock( &job->lock );
+			job->err = 1;
+			pthread_mutex_unlock( &job->lock );
+		}
+	}
+	return NULL;
+}
+
+/**
+ * \brief  Set the number of threads used to decode the segments of an image
+ *
+ * If an image overlaps fewer segments than threads, e.g. small regions of
+ * the HRV channel, the lines of each segment are split into groups mapped
+ * by the spare threads.
+ *
+ * \param[in]  n      the number of threads, values <1 select 1 thread
+ *
+ * \return     nothing
+ */
+void msevi_l15hrit_set_nthreads( int n )
+{
+	decode_nthreads = (n<1) ? 1 : n;
+	return;
+}
+
+/**
+ * \brief  Set the calibration table of a channel
+ *
+ * Images of the channel returned by msevi_l15hrit_read_image() and
+ * msevi_l15hrit_read_images() get calibrated values, which are looked up
+ * in the table while the segments are mapped, see msevi_l15_calib_pack().
+ * The table is not copied, and has to remain valid while reading.
+ *
+ * \param[in]  chan_id  the channel id
+ * \param[in]  lut      the packed table, or NULL to read counts only
+ *
+ * \return     nothing
+ */
+void msevi_l15hrit_set_calib( int chan_id, const uint16_t *lut )
+{
+	if( chan_id>=1 && chan_id<=MSEVI_NCHAN ) image_calib_lut[chan_id] = lut;
+	return;
+}
+
+/**
+ * \brief  Set the tile size of the images read
+ *
+ * Images returned by msevi_l15hrit_read_image() and msevi_l15hrit_read_images()
+ * are tiled with the given tile size, see msevi_l15_image_alloc_tiled().
+ *
+ * \param[in]  nlin   the number of lines of a tile, 0 for row-major images
+ * \param[in]  ncol   the number of columns of a tile, 0 for row-major images
+ *
+ * \return     nothing
+ */
+void msevi_l15hrit_set_tile_size( int nlin, int ncol )
+{
+	if( nlin>0 && ncol>0 ) {
+		image_tile_nlin = nlin;
+		image_tile_ncol = ncol;
+	} else {
+		image_tile_nlin = 0;
+		image_tile_ncol = 0;
+	}
+	return;
+}
+
+/**
+ * \brief  Enable the cache of decompressed segments
+ *
+ * Decompressed counts of compressed segments and decoded prologues are
+ * stored in the cache directory, and re-used when the same segment or
+ * prologue is decoded again, e.g. for different regions or by repeated
+ * runs. The least recently used
+ * entries are removed when the cache grows beyond max_size.
+ *
+ * \param[in]  dir       the cache directory, or NULL to disable the cache
+ * \param[in]  max_size  the size limit of the cache, in bytes
+ *
+ * \return     nothing
+ */
+void msevi_l15hrit_set_cache( char *dir, size_t max_size )
+{
+	cache_dir = dir;
+	cache_max_size = max_size;
+	return;
+}
+
+/* zero n counts of an image line starting at column col, crossing tiles */
+static void clear_span( struct msevi_l15_image *img, int lin, int col, int n )
+{
+	int m;
+
+	for( ; n>0; col+=m, n-=m ) {
+		m = (img->tile_ncol>0) ? img->tile_ncol-col%img->tile_ncol : n;
+		if( m>n ) m = n;
+		memset( msevi_l15_image_pixel(img, lin, col), 0, m*sizeof(uint16_t) );
+	}
+	return;
+}
+
+/* zero the counts of an image not covered by any of the segments, the
+   other counts are all written when the segments are decoded */
+static void clear_uncovered( struct msevi_l15_image *img, int nseg,
+			     struct msevi_l15hrit_segment **seg )
+{
+	int il, j, line, east, west;
+	struct msevi_l15_coverage *cov = &img->coverage, *sc = NULL;
+
+	for( il=0; il<img->nlin; il++ ) {
+		line = (int)cov->northern_line-il;
+		for( j=0; j<nseg; j++ ) {
+			sc = &seg[j]->coverage;
+			if( line>=(int)sc->southern_line && line<=(int)sc->northern_line ) break;
+		}
+		if( j==nseg ) {
+			clear_span( img, il, 0, img->ncol );
+			continue;
+		}
+		east = MAX(cov->eastern_column, sc->eastern_column);
+		west = MIN(cov->western_column, sc->western_column);
+		if( west<east ) {
+			clear_span( img, il, 0, img->ncol );
+			continue;
+		}
+		clear_span( img, il, 0, cov->western_column-west );
+		clear_span( img, il, cov->western_column-east+1, east-cov->eastern_column );
+	}
+	return;
+}
+
+/**
+ * \brief  Read the segments of a channel into several images
+ *
+ * Each segment is opened and decoded once, and written to all images it
+ * overlaps, so that several regions are extracted in one pass over the
+ * segments.
+ *
+ * \param[in]  nfile  the number of segment files
+ * \param[in]  files  the segment files
+ * \param[in]  nimg   the number of images
+ * \param[in]  cov    the coverage of each image
+ * \param[out] img    the images, allocated from the buffer pool by this
+ *                    function, see msevi_l15_image_alloc_pooled()
+ *
+ * \return     0 on success, or -1 on failure
+ */
+int msevi_l15hrit_read_images( int nfile, char **files, int nimg,
+			       struct msevi_l15_coverage *cov,
+			       struct msevi_l15_image **img )
+{
+	int i, k, n = 0, nthreads;
+	struct msevi_l15hrit_segment **seg = NULL;
+	struct xrit_file **xf = NULL;
+	struct xrit_batch *batch = NULL;
+	struct decode_job job;
+	pthread_t *threads = NULL;
+
+	/* allocate memory for images */
+	memset( img, 0, nimg*sizeof(*img) );
+	for( k=0; k<nimg; k++ ) {
+		img[k] = msevi_l15_image_alloc_pooled( cov[k].northern_line-cov[k].southern_line+1,
+						       cov[k].western_column-cov[k].eastern_column+1,
+						       image_tile_nlin, image_tile_ncol );
+		if(img[k]==NULL) goto err_out;
+		memcpy( &img[k]->coverage, cov+k, sizeof(struct msevi_l15_coverage) );
+	}
+
+	seg = calloc( nfile>0 ? nfile : 1, sizeof(*seg) );
+	xf  = calloc( nfile>0 ? nfile : 1, sizeof(*xf) );
+	if( seg==NULL || xf==NULL ) goto err_out;
+
+	/* open all segments, keeping only those overlapping an image */
+	for (i=0; i<nfile; i++) {
+		seg[n] = msevi_l15hrit_open_segment( files[i] );
+		if(seg[n]==NULL) goto err_out;
+		for( k=0; k<nimg; k++ ) {
+			if( coverage_overlaps(cov+k, &seg[n]->coverage) ) break;
+		}
+		if( k==nimg ) {
+			msevi_l15hrit_close_segment( seg[n] );
+			seg[n] = NULL;
+			continue;
+		}
+		xf[n] = seg[n]->xf;
+		n++;
+	}
+	for( k=0; n>0 && k<nimg; k++ ) {
+		img[k]->spacecraft_id = seg[0]->hdr.seg_id.sat_id;
+		img[k]->channel_id    = seg[0]->hdr.seg_id.channel_id;
+		if( img[k]->channel_id<=MSEVI_NCHAN && image_calib_lut[img[k]->channel_id] ) {
+			if( msevi_l15_image_alloc_calib( img[k] )<0 ) goto err_out;
+			img[k]->calib_lut = image_calib_lut[img[k]->channel_id];
+		}
+	}
+
+	/* the counts of pooled images are not initialised, clear those no
+	   segment is written to */
+	for( k=0; k<nimg; k++ ) clear_uncovered( img[k], n, seg );
+
+	/* read ahead the data of the following segments, while the workers
+	   decode the segments as they arrive */
+	nthreads = MIN(decode_nthreads, n);
+	batch = xrit_batch_read( n, xf, 0, nthreads+XRIT_BATCH_WINDOW );
+	if(batch==NULL) goto err_out;
+
+	memset( &job, 0, sizeof(job) );
+	job.img   = img;
+	job.nimg  = nimg;
+	job.seg   = seg;
+	job.batch = batch;
+	job.n     = n;
+	job.seg_nthreads = MAX(decode_nthreads/MAX(n,1), 1);
+	pthread_mutex_init( &job.lock, NULL );
+
+	/* the calling thread is one of the workers */
+	if( nthreads>1 ) threads = calloc( nthreads-1, sizeof(pthread_t) );
+	for( i=0; threads && i<nthreads-1; i++ ) {
+		if( pthread_create( threads+i, NULL, decode_worker, &job )!=0 ) break;
+	}
+	nthreads = i;
+	decode_worker( &job );
+	for( i=0; i<nthreads; i++ ) pthread_join( threads[i], NULL );
+	pthread_mutex_destroy( &job.lock );
+	free( threads );
+	if( job.err ) goto err_out;
+
+	xrit_batch_free( batch );
+	for (i=0; i<n; i++) msevi_l15hrit_close_segment( seg[i] );
+	free( seg );
+	free( xf );
+	return 0;
+
+err_out:
+	xrit_batch_free( batch );
+	if( seg ) {
+		for (i=0; i<nfile; i++) msevi_l15hrit_close_segment( seg[i] );
+	}
+	free( seg );
+	free( xf );
+	for( k=0; k<nimg; k++ ) {
+		msevi_l15_image_free( img[k] );
+		img[k] = NULL;
 	}
+	return -1;
+}
 
-	/* cleanup and return */
-	xrit_fclose(xf);
-	free(prim);
-	free(img_struct);
-	free(img_nav);
-	free(seg_id);
-	free(line_qual);
-	free(hdr);
+struct msevi_l15_image *msevi_l15hrit_read_image( int nfile, char **files,
+						  struct msevi_l15_coverage *cov )
+{
+	struct msevi_l15_image *img;
+	struct msevi_l15_coverage full = { "vis_ir", 1, 3712, 1, 3712 };
 
+	if( cov==NULL ) cov = &full;
+	if( msevi_l15hrit_read_images( nfile, files, 1, cov, &img )<0 ) return NULL;
 	return img;
-
- err_out:
-	return NULL;
 }
 
-static int map_segment(struct msevi_l15_image *dest, struct msevi_l15_image *src)
+/*
+ * Add the counts of a segment to the block sums of a reduced resolution
+ * image, and set the line side information of the image lines whose
+ * northern-most full resolution line lies within the segment.
+ */
+static int scale_segment( struct msevi_l15_image *img, uint32_t *sum, int scale,
+			  struct msevi_l15hrit_segment *seg )
 {
-	int il, ic, nlin, ncol;
+	int il, ic, l, first, n, nlin, ncol, cached = 0;
 	int south_lin, north_lin, east_col, west_col;
-	uint16_t *csrc, *cdest;
-
-	south_lin = MAX(dest->coverage.southern_line, src->coverage.southern_line);
-	north_lin = MIN(dest->coverage.northern_line, src->coverage.northern_line);
-	east_col  = MAX(dest->coverage.eastern_column, src->coverage.eastern_column);
-	west_col  = MIN(dest->coverage.western_column, src->coverage.western_column);
-
+	size_t src_ncol, ncol_s = img->ncol;
+	struct msevi_l15_coverage *dcov = &img->coverage, *scov = &seg->coverage;
+	struct xrit_hrec_image_structure *is = &seg->hdr.img_struct;
+	struct msevi_l15cache_entry e;
+	uint16_t *counts = NULL, *line = NULL, *src;
+	uint32_t *dsum;
+	uint64_t key = 0;
+	void *packed = NULL;
+
+	south_lin = MAX(dcov->southern_line, scov->southern_line);
+	north_lin = MIN(dcov->northern_line, scov->northern_line);
+	east_col  = MAX(dcov->eastern_column, scov->eastern_column);
+	west_col  = MIN(dcov->western_column, scov->western_column);
 	nlin = north_lin-south_lin+1;
 	ncol = west_col-east_col+1;
-	if(nlin<0||ncol<0) return 0; /* no overlap of regions */
-
-	for(il=0;il<nlin;il++) {
-		int loff_dest, loff_src;
-
-		/* calculate line offsets */
-		loff_dest = dest->coverage.northern_line-north_lin+il;
-		loff_src  = south_lin-src->coverage.southern_line+nlin-il-1;
-
-		/* copy line side information */
-		memcpy( dest->line_side_info+loff_dest, src->line_side_info+loff_src,
-		        sizeof(struct msevi_l15_line_side_info) );
-
-		/* get data pointers, add column offsets */
-		cdest  = dest->counts + loff_dest*dest->ncol;
-		csrc   = src->counts  + loff_src*src->ncol;
-		cdest +=  dest->coverage.western_column-west_col;
-		csrc  +=  east_col-src->coverage.eastern_column+(ncol-1);
-
-		/* and write counts */
-		for(ic=0;ic<ncol;ic++) 	*cdest++ = *csrc--;
+	if(nlin<=0||ncol<=0) return 0;
+
+	/* get the counts of the overlapping lines, segment lines
+	   [first,first+n) */
+	src_ncol = is->ncol;
+	first = south_lin-scov->southern_line;
+	n     = nlin;
+	if( is->compression==0 && is->bpp==10 ) {
+		if( seg->xf->data_len<(uint64_t)is->nlin*is->ncol*is->bpp ) return -1;
+		packed = xrit_get_data( seg->xf );
+		line   = malloc( ncol*sizeof(uint16_t) );
+		if( packed==NULL || line==NULL ) goto err_out;
+	} else if( is->compression>0 && cache_dir!=NULL ) {
+		key = msevi_l15cache_key( seg->fnam, xrit_get_header(seg->xf),
+					  seg->xf->header_len, seg->xf->data_len );
+		if( msevi_l15cache_get(cache_dir, key, is->nlin, is->ncol, &e)==0 ) {
+			counts = e.data;
+			first  = 0;
+			cached = 1;
+		} else {
+			counts = decode_counts( seg, &first, &n );
+			if( counts ) msevi_l15cache_put( cache_dir, cache_max_size, key,
+							 is->nlin, is->ncol, counts );
+		}
+	} else {
+		counts = decode_counts( seg, &first, &n );
 	}
-	if( dest->spacecraft_id == 0 ) {
-		dest->spacecraft_id = src->spacecraft_id;
-		dest->channel_id = src->channel_id;
+	if( packed==NULL && counts==NULL ) goto err_out;
+
+	/* sum the overlapping pixels into the blocks, the northern-most line
+	   and western-most column map to the first image line and column */
+	for( il=0; il<nlin; il++ ) {
+		l = dcov->northern_line-(north_lin-il);
+		if( l%scale==0 ) {
+			msevi_l15hrit_decode_line_quality( &seg->hdr, north_lin-il-scov->southern_line,
+							   1, 1, img->line_side_info+l/scale );
+		}
+		if( packed ) {
+			src = line;
+			unpack_10bit_to_16bit( packed, line, (size_t)(north_lin-il-scov->southern_line)
+					       *src_ncol + east_col-scov->eastern_column, ncol );
+		} else {
+			src = counts + (size_t)(north_lin-il-scov->southern_line-first)*src_ncol
+				+ east_col-scov->eastern_column;
+		}
+		dsum = sum + (size_t)(l/scale)*ncol_s;
+		for( ic=0; ic<ncol; ic++ ) {
+			dsum[(dcov->western_column-east_col-ic)/scale] += src[ic];
+		}
+	}
+
+	if( cached ) {
+		msevi_l15cache_release( &e );
+	} else {
+		free( counts );
 	}
+	free( line );
 	return nlin;
-}
 
+err_out:
+	free( line );
+	return -1;
+}
 
-int msevi_l15hrit_get_segment_coverage( char *fnam, struct msevi_l15_coverage *cov )
+/**
+ * \brief  Read a reduced resolution SEVIRI L15 HRIT image
+ *
+ * Each image pixel is the mean of a block of scale x scale full resolution
+ * pixels, the blocks at the southern and eastern edge of the coverage may
+ * be smaller. The coverage of the image is given in full resolution lines
+ * and columns, i.e. the image has ceil(nlin/scale) lines and
+ * ceil(ncol/scale) columns, and the line side information of an image line
+ * is that of the northern-most full resolution line of its blocks.
+ * Segments are summed into the blocks as they are decoded, no full
+ * resolution image is allocated.
+ *
+ * \param[in]  nfile  the number of segment files
+ * \param[in]  files  the segment files
+ * \param[in]  cov    the coverage, or NULL for the full VIS/IR disk
+ * \param[in]  scale  the reduction factor, e.g. 2, 4 or 8
+ *
+ * \return     the image, or NULL on failure
+ */
+struct msevi_l15_image *msevi_l15hrit_read_image_scaled( int nfile, char **files,
+							 struct msevi_l15_coverage *cov,
+							 int scale )
 {
-	struct xrit_file *xf;
-	void *hdr, *hrec;
-	struct xrit_hrec_image_structure  *img_struct;
-	struct xrit_hrec_image_navigation *img_nav;
-	struct msevi_hrec_segment_identification *seg_id;
-
-	/* open file and check that it is an image */
-	xf  = xrit_fopen(fnam, "rb");
-	if( xf==NULL || xf->ftype!=XRIT_FTPYE_IMAGE ) goto err_out;
-
-	/* read relevant header records */
-	hdr = xrit_read_header( xf );
-	if(hdr==NULL) goto err_out;
-
-	hrec = xrit_find_hrec(hdr, xf->header_len, XRIT_HREC_IMAGE_STRUCTURE);
-	img_struct = xrit_decode_hrec(hrec);
-
-	hrec = xrit_find_hrec(hdr, xf->header_len, XRIT_HREC_IMAGE_NAVIGATION);
-	img_nav = xrit_decode_hrec(hrec);
-	hrec = xrit_find_hrec(hdr, xf->header_len, MSEVI_HREC_SEGMENT_IDENTIFICATION );
-	seg_id = msevi_l15hrit_decode_hrec(hrec);
-
-	if(seg_id->channel_id==12) { /* special-case HRV */
-		cov->southern_line  = 5566-img_nav->loff+1;
-		cov->northern_line  = cov->southern_line+img_struct->nlin-1;
-		cov->eastern_column = 5566-img_nav->coff+1;
-		cov->western_column = cov->eastern_column+img_struct->ncol-1;
-	} else {
+	int i, il, ic, nlin, ncol, nl, nc;
+	struct msevi_l15_image *img = NULL;
+	struct msevi_l15hrit_segment *seg;
+	struct msevi_l15_coverage full = { "vis_ir", 1, 3712, 1, 3712 };
+	uint32_t *sum = NULL;
+
+	if( cov==NULL ) cov = &full;
+	if( scale<1 ) return NULL;
+	nlin = cov->northern_line-cov->southern_line+1;
+	ncol = cov->western_column-cov->eastern_column+1;
+
+	img = msevi_l15_image_alloc( (nlin+scale-1)/scale, (ncol+scale-1)/scale );
+	if( img==NULL ) goto err_out;
+	sum = calloc( (size_t)img->nlin*img->ncol, sizeof(uint32_t) );
+	if( sum==NULL ) goto err_out;
+	memcpy( &img->coverage, cov, sizeof(struct msevi_l15_coverage) );
 
-		cov->southern_line  = 1856-img_nav->loff+1;
-		cov->northern_line  = cov->southern_line+img_struct->nlin-1;
-		cov->eastern_column = 1856-img_nav->coff+1;
-		cov->western_column = cov->eastern_column+img_struct->ncol-1;
+	for (i=0; i<nfile; i++) {
+		seg = msevi_l15hrit_open_segment( files[i] );
+		if(seg==NULL) goto err_out;
+		if( coverage_overlaps(cov, &seg->coverage) ) {
+			if( img->spacecraft_id==0 ) {
+				img->spacecraft_id = seg->hdr.seg_id.sat_id;
+				img->channel_id    = seg->hdr.seg_id.channel_id;
+			}
+			if( scale_segment( img, sum, scale, seg )<0 ) {
+				msevi_l15hrit_close_segment( seg );
+				goto err_out;
+			}
+		}
+		msevi_l15hrit_close_segment( seg );
 	}
 
-	return 0;
+	/* block means, rounded */
+	for( il=0; il<img->nlin; il++ ) {
+		nl = MIN(scale, nlin-il*scale);
+		for( ic=0; ic<img->ncol; ic++ ) {
+			nc = MIN(scale, ncol-ic*scale);
+			img->counts[(size_t)il*img->ncol+ic] =
+				(sum[(size_t)il*img->ncol+ic]+nl*nc/2)/(nl*nc);
+		}
+	}
+	free( sum );
+	return img;
 
 err_out:
-	return -1;
+	free( sum );
+	msevi_l15_image_free( img );
+	return NULL;
 }
 
-static int coverage_overlaps ( struct msevi_l15_coverage *c1,
-			       struct msevi_l15_coverage *c2 )
+/* decode one line quality entry */
+static inline void decode_line_quality_entry( void *entry,
+					      struct msevi_l15_line_side_info *lsi )
 {
-	if(     c1->southern_line  > c2->northern_line
-	     || c1->northern_line  < c2->southern_line
-	     || c1->eastern_column > c2->western_column
-             || c1->western_column < c2->eastern_column )
-		return 0;
-	return 1;
+	memcpy_be32toh(&lsi->nr_in_grid, entry, 1);
+	memcpy_be16toh(&lsi->acquisition_time.days, entry+4, 1);
+	memcpy_be32toh(&lsi->acquisition_time.msec, entry+6, 1);
+	memcpy(&lsi->validity,            entry+10, 1);
+	memcpy(&lsi->radiometric_quality, entry+11, 1);
+	memcpy(&lsi->geometric_quality,   entry+12, 1);
+	return;
 }
 
-
-struct msevi_l15_image *msevi_l15hrit_read_image( int nfile, char **files,
-						  struct msevi_l15_coverage *cov )
-
+/**
+ * \brief  Decode line quality entries of a parsed segment header
+ *
+ * Entries missing from the header leave the destination untouched.
+ *
+ * \param[in]  h      the parsed segment header
+ * \param[in]  first  the index of the first segment line to decode
+ * \param[in]  n      the number of lines to decode
+ * \param[in]  step   the increment of the segment line index, i.e. -1 to
+ *                    decode lines in reverse order
+ * \param[out] lsi    the destination line side information
+ *
+ * \return     nothing
+ */
+void msevi_l15hrit_decode_line_quality( struct msevi_l15hrit_header *h, int first, int n,
+					int step, struct msevi_l15_line_side_info *lsi )
 {
-	int i, r;
-	struct msevi_l15_image   *img = NULL, *seg;
-	int nlin, ncol;
+	int i, il;
 
-	/* allocate memory for image */
-	if( cov != NULL ) {
-		nlin = cov->northern_line-cov->southern_line+1;
-		ncol = cov->western_column-cov->eastern_column+1;
-	} else {
-		nlin = 3712;
-		ncol = 3712;
+	if( !(h->found & MSEVI_L15HRIT_HAS_LINE_QUALITY) ) return;
+
+	for( i=0, il=first; i<n; i++, il+=step ) {
+		if( il<0 || il>=h->nlin_quality ) continue;
+		decode_line_quality_entry( h->line_quality+il*13, lsi+i );
 	}
-	img = msevi_l15_image_alloc( nlin, ncol );
-	if(img==NULL) goto err_out;
-	memcpy( &img->coverage, cov, sizeof(struct msevi_l15_coverage) );
+	return;
+}
 
-	/* read segments */
-	for (i=0; i<nfile; i++) {
-		struct msevi_l15_coverage seg_cov;
-		r = msevi_l15hrit_get_segment_coverage( files[i], &seg_cov );
-		if( coverage_overlaps(cov, &seg_cov) ) {
-			seg = msevi_l15hrit_read_segment( files[i] );
-			if(seg==NULL) goto err_out;
-
-			map_segment(img, seg);
-			msevi_l15_image_free( seg );
-		} else {
-			// printf("Skipping: %s\n", files[i] );
+/**
+ * \brief  Decode all known header records of a SEVIRI L15 HRIT segment
+ *
+ * The header is walked once, and all known records are decoded into the
+ * caller-provided structure without any memory allocation. Line quality
+ * entries are not decoded, but referenced within the header.
+ *
+ * \param[in]  hdr    the XRIT header
+ * \param[in]  len    the length of the header
+ * \param[out] h      the decoded header records
+ *
+ * \return     0 on success, or -1 if the header is corrupt
+ */
+int msevi_l15hrit_parse_header( void *hdr, size_t len, struct msevi_l15hrit_header *h )
+{
+	uint8_t  hrec_type;
+	uint16_t hrec_len;
+	void     *hrec = hdr;
+
+	memset( h, 0, sizeof(*h) );
+
+	while( hrec+3<=hdr+len ) {
+		memcpy(&hrec_type, hrec, 1);
+		memcpy_be16toh(&hrec_len, hrec+1, 1);
+		if( hrec_len<3 || hrec+hrec_len>hdr+len ) return -1;
+
+		switch (hrec_type) {
+		case XRIT_HREC_PRIMARY:
+			xrit_unpack_hrec( hrec, &h->prim );
+			h->found |= MSEVI_L15HRIT_HAS_PRIMARY;
+			break;
+		case XRIT_HREC_IMAGE_STRUCTURE:
+			xrit_unpack_hrec( hrec, &h->img_struct );
+			h->found |= MSEVI_L15HRIT_HAS_IMAGE_STRUCTURE;
+			break;
+		case XRIT_HREC_IMAGE_NAVIGATION:
+			xrit_unpack_hrec( hrec, &h->img_nav );
+			h->found |= MSEVI_L15HRIT_HAS_IMAGE_NAVIGATION;
+			break;
+		case MSEVI_HREC_SEGMENT_IDENTIFICATION:
+			msevi_l15hrit_unpack_hrec( hrec, &h->seg_id );
+			h->found |= MSEVI_L15HRIT_HAS_SEGMENT_ID;
+			break;
+		case MSEVI_HREC_SEGMENT_LINE_QUALITY:
+			h->line_quality = hrec+3;
+			h->nlin_quality = (hrec_len-3)/13;
+			h->found |= MSEVI_L15HRIT_HAS_LINE_QUALITY;
+			break;
+		default:
+			break;
 		}
+		hrec += hrec_len;
 	}
-	return img;
-
-err_out:
-	msevi_l15_image_free(img);
-	return NULL;
+	return 0;
 }
 
+/**
+ * \brief  Unpack a SEVIRI segment identification record
+ *
+ * \param[in]  hrec   a pointer to the header record
+ * \param[out] si     the decoded segment identification
+ *
+ * \return     0 on success, or -1 if hrec is not a segment identification
+ */
+int msevi_l15hrit_unpack_hrec( void *hrec, struct msevi_hrec_segment_identification *si )
+{
+	memcpy(&si->hrec_type, hrec, 1);
+	if( si->hrec_type!=MSEVI_HREC_SEGMENT_IDENTIFICATION ) return -1;
+
+	memcpy_be16toh(&si->hrec_len, hrec+1, 1);
+	memcpy_be16toh(&si->sat_id, hrec+3, 1);
+	memcpy(&si->channel_id, hrec+5, 1);
+	memcpy_be16toh(&si->segm_seq_nr, hrec+6, 1);
+	memcpy_be16toh(&si->planned_start_segm_seq_nr, hrec+8, 1);
+	memcpy_be16toh(&si->planned_end_segm_seq_nr, hrec+10, 1);
+	memcpy(&si->data_field_representation, hrec+12, 1);
+	return 0;
+}
 
 void *msevi_l15hrit_decode_hrec( void *hrec )
 {
@@ -399,15 +1458,7 @@ void *msevi_l15hrit_decode_hrec( void *hrec )
 		si = calloc(1,sizeof(*si));
 		if(si==NULL) goto err_out;
 
-		si->hrec_type = hrec_type;
-		si->hrec_len  = hrec_len;
-		memcpy(&si->sat_id, hrec+3, 2);
-		memcpy(&si->channel_id, hrec+5, 1);
-		memcpy_be16toh(&si->segm_seq_nr, hrec+6, 1);
-		memcpy_be16toh(&si->planned_start_segm_seq_nr, hrec+8, 1);
-		memcpy_be16toh(&si->planned_end_segm_seq_nr, hrec+10, 1);
-		memcpy(&si->data_field_representation, hrec+12, 1);
-
+		msevi_l15hrit_unpack_hrec( hrec, si );
 		return si;
 	}
 	case MSEVI_HREC_SEGMENT_LINE_QUALITY: {
@@ -424,12 +1475,7 @@ void *msevi_l15hrit_decode_hrec( void *hrec )
 		lq->line_side_info = calloc(nlin, sizeof(*lq->line_side_info));
 
 		for(i=0; i<nlin; i++) {
-			memcpy_be32toh(&lq->line_side_info[i].nr_in_grid, entry, 1);
-			memcpy_be16toh(&lq->line_side_info[i].acquisition_time.days, entry+4, 1);
-			memcpy_be32toh(&lq->line_side_info[i].acquisition_time.msec, entry+6, 1);
-			memcpy(&lq->line_side_info[i].validity,            entry+10, 1);
-			memcpy(&lq->line_side_info[i].radiometric_quality, entry+11, 1);
-			memcpy(&lq->line_side_info[i].geometric_quality,   entry+12, 1);
+			decode_line_quality_entry( entry, lq->line_side_info+i );
 			entry += 13;
 		}
 		return lq;
@@ -438,230 +1484,334 @@ err_out:
 	return NULL;
 }
 
-struct msevi_l15_header *msevi_l15hrit_read_prologue( char *file )
+/* decode the satellite status record */
+static void decode_satellite_status( struct msevi_l15_header *header, void *rec )
 {
+	int i;
+	void *rec_ptr;
 
-	int i,j;
-	struct msevi_l15_header *header;
-	struct xrit_file *pro;
-	void *data;
+	{ /* get satellite definition */
+		struct _satellite_definition *sd =
+			&header->satellite_status.satellite_definition;
+		rec_ptr = rec;
+
+		memcpy_be16toh( &sd->satellite_id, rec_ptr, 1 );
+		memcpy_be32toh( &sd->nominal_longitude, rec_ptr+2, 1 );
+		memcpy( &sd->satellite_status, rec_ptr+6, 1 );
+	}
+	{ /* get satellite orbit */
+		struct _orbit *orb = &header->satellite_status.orbit;
+		rec_ptr = rec+7+28;
+		memcpy_be16toh( &orb->period_start_time.days,  rec_ptr,   1 );
+		memcpy_be32toh( &orb->period_start_time.msec,  rec_ptr+2, 1 );
+		memcpy_be16toh( &orb->period_end_time.days,    rec_ptr+6, 1 );
+		memcpy_be32toh( &orb->period_end_time.msec,    rec_ptr+8, 1 );
+
+		rec_ptr = rec+7+28+12;
+		for( i=0; i<100; i++ ){
+			memcpy_be16toh( &orb->orbitcoef[i].start_time.days,  rec_ptr, 1);
+			memcpy_be32toh( &orb->orbitcoef[i].start_time.msec, rec_ptr+2, 1);
+			memcpy_be16toh( &orb->orbitcoef[i].end_time.days,  rec_ptr+6, 1);
+			memcpy_be32toh( &orb->orbitcoef[i].end_time.msec, rec_ptr+8, 1);
+			memcpy_be64toh( &orb->orbitcoef[i].x,  rec_ptr+ 12, 8 );
+			memcpy_be64toh( &orb->orbitcoef[i].y,  rec_ptr+ 76, 8 );
+			memcpy_be64toh( &orb->orbitcoef[i].z,  rec_ptr+140, 8 );
+			memcpy_be64toh( &orb->orbitcoef[i].vx, rec_ptr+204, 8 );
+			memcpy_be64toh( &orb->orbitcoef[i].vy, rec_ptr+268, 8 );
+			memcpy_be64toh( &orb->orbitcoef[i].vz, rec_ptr+332, 8 );
+			rec_ptr += 396;
+		}
+	}
+	return;
+}
+
+/* decode the image acquisition record */
+static void decode_image_acquisition( struct msevi_l15_header *header, void *rec )
+{
+	{ /* planned acquisition time */
+		struct _planned_acquisition_time *pat =
+			&header->image_acquisition.planned_acquisition_time;
+		void *rec_ptr = rec;
+
+		memcpy_be16toh( &pat->true_repeat_cycle_start.days,  rec_ptr+0, 1);
+		memcpy_be32toh( &pat->true_repeat_cycle_start.msec, rec_ptr+2, 1);
+		memcpy_be16toh( &pat->planned_fwd_scan_end.days,  rec_ptr+10, 1);
+		memcpy_be32toh( &pat->planned_fwd_scan_end.msec, rec_ptr+12, 1);
+		memcpy_be16toh( &pat->planned_repeat_cylce_end.days,  rec_ptr+20, 1);
+		memcpy_be32toh( &pat->planned_repeat_cylce_end.msec, rec_ptr+22, 1);
+	}
+	return;
+}
+
+/* decode the image description record */
+static void decode_image_description( struct msevi_l15_header *header, void *rec )
+{
 	void *rec_ptr;
-	off_t nbyte;
 
-	/* allocate structure */
-	header = calloc( 1, sizeof(*header) );
-	if( header==NULL ) goto err_out;
+	{  /* type of projection */
+		struct _projection_description *pd =
+			&header->image_description.projection_description;
+
+		rec_ptr = rec;
+		memcpy( &pd->type_of_projection, rec_ptr, 1 );
+		memcpy_be32toh( &pd->longitude_of_ssp, rec_ptr+1, 1);
+	} { /* reference grid */
+
+		struct _reference_grid *rg =
+			&header->image_description.reference_grid_vis_ir;
+		rec_ptr = rec+5;
+
+		memcpy_be32toh( &rg->number_of_lines, rec_ptr, 1 );
+		memcpy_be32toh( &rg->number_of_columns, rec_ptr+4, 1 );
+		memcpy_be32toh( &rg->line_dir_grid_step, rec_ptr+8, 1 );
+		memcpy_be32toh( &rg->column_dir_grid_step, rec_ptr+12, 1 );
+		memcpy( &rg->grid_origin, rec_ptr+16, 1 );
+		/* printf("nlin=%d ncol=%d lstep=%f cstep=%f origin=%d\n",
+		       rg->number_of_lines, rg->number_of_columns,
+		       rg->line_dir_grid_step,  rg->column_dir_grid_step,
+		       rg->grid_origin ); */
+
+		rg = &header->image_description.reference_grid_hrv;
+		rec_ptr = rec+22;
+
+		memcpy_be32toh( &rg->number_of_lines, rec_ptr, 1 );
+		memcpy_be32toh( &rg->number_of_columns, rec_ptr+4, 1 );
+		memcpy_be32toh( &rg->line_dir_grid_step, rec_ptr+8, 1 );
+		memcpy_be32toh( &rg->column_dir_grid_step, rec_ptr+12, 1 );
+		memcpy( &rg->grid_origin, rec_ptr+16, 1 );
+		/* printf("nlin=%d ncol=%d lstep=%f cstep=%f origin=%d\n",
+		       rg->number_of_lines, rg->number_of_columns,
+		       rg->line_dir_grid_step,  rg->column_dir_grid_step,
+		       rg->grid_origin ); */
+	} { /* planned coverage */
+		struct msevi_l15_coverage *cov;
+
+		/* planned VIS/IR coverage */
+		cov = &header->image_description.planned_coverage_vis_ir;
+		rec_ptr = rec+39;
+		memcpy_be32toh( &cov->southern_line, rec_ptr, 1 );
+		memcpy_be32toh( &cov->northern_line, rec_ptr+4, 1 );
+		memcpy_be32toh( &cov->eastern_column, rec_ptr+8, 1 );
+		memcpy_be32toh( &cov->western_column, rec_ptr+12, 1 );
+		printf("VISIR coverage: %d %d %d %d\n", cov->southern_line,cov->northern_line,cov->eastern_column,cov->western_column);
+
+		/* planned lower HRV coverage */
+		cov =  &header->image_description.planned_coverage_hrv_lower;
+		rec_ptr = rec+55;
+		memcpy_be32toh( &cov->southern_line, rec_ptr, 1 );
+		memcpy_be32toh( &cov->northern_line, rec_ptr+4, 1 );
+		memcpy_be32toh( &cov->eastern_column, rec_ptr+8, 1 );
+		memcpy_be32toh( &cov->western_column, rec_ptr+12, 1 );
+
+		/* planned upper HRV coverage */
+		cov =  &header->image_description.planned_coverage_hrv_upper;
+		rec_ptr = rec+71;
+		memcpy_be32toh( &cov->southern_line, rec_ptr, 1 );
+		memcpy_be32toh( &cov->northern_line, rec_ptr+4, 1 );
+		memcpy_be32toh( &cov->eastern_column, rec_ptr+8, 1 );
+		memcpy_be32toh( &cov->western_column, rec_ptr+12, 1 );
+	} { /* l15 image production */
+		struct _l15_image_production *ip = &header->image_description.l15_image_production;
+		rec_ptr = rec+87;
+		memcpy( &ip->image_proc_direction, rec_ptr, 1 );
+		memcpy( &ip->pixel_gen_direction, rec_ptr+1, 1 );
+		memcpy( &ip->planned_chan_processing, rec_ptr+2, 12 );
+	}
+	return;
+}
+
+/* decode the radiometric processing record */
+static void decode_radiometric_processing( struct msevi_l15_header *header, void *rec )
+{
+	int i;
+
+	{ /* L15 image calibration */
+		struct _l15_image_calibration *cal = header->radiometric_processing.l15_image_calibration;
+		void *rec_ptr = rec+72;
+
+		for( i=0; i<MSEVI_NCHAN; i++ ) {
+			memcpy_be64toh(&cal->cal_slope, rec_ptr+(2*i)*sizeof(double), 1);
+			memcpy_be64toh(&cal->cal_offset, rec_ptr+(2*i+1)*sizeof(double), 1);
+			cal++;
+		}
+	}
+	return;
+}
+
+/* decode the geometric processing record */
+static void decode_geometric_processing( struct msevi_l15_header *header, void *rec )
+{
+	void *rec_ptr;
+
+	{ /* Optical Axis Distance */
+		int i;
+		struct _opt_axis_distance *oad = &header->geometric_processing.opt_axis_distance;
+		rec_ptr = rec;
+		for( i=0; i<MSEVI_NR_CHAN; i++ ) memcpy_be32toh(oad->ew_focal_plane+i, rec_ptr+i*sizeof(float), 1);
+		for( i=0; i<MSEVI_NR_CHAN; i++ ) memcpy_be32toh(oad->ns_focal_plane+i, rec_ptr+(42+i)*sizeof(float), 1);
+	}
+	{ /* Earth model */
+		struct _earth_model *em= &header->geometric_processing.earth_model;
+		rec_ptr = rec+42*2*sizeof(float);
+		memcpy( &em->type, rec_ptr, 1 );
+		memcpy_be64toh( &em->equatorial_radius, rec_ptr+1, 1);
+		memcpy_be64toh( &em->north_polar_radius, rec_ptr+9, 1);
+		memcpy_be64toh( &em->south_polar_radius, rec_ptr+17, 1);
+	}
+	return;
+}
+
+/* decoders of the header records, indexed like header_rec_off */
+static void (*const header_rec_decode[8])( struct msevi_l15_header *, void * ) = {
+	NULL,
+	decode_satellite_status,
+	decode_image_acquisition,
+	NULL,
+	decode_image_description,
+	decode_radiometric_processing,
+	decode_geometric_processing,
+	NULL
+};
+
+/**
+ * \brief  Read a SEVIRI L15 HRIT prologue file
+ *
+ * \param[in]  file   the prologue file
+ *
+ * \return     the decoded prologue, or NULL on failure
+ */
+struct msevi_l15_header *msevi_l15hrit_read_prologue( char *file )
+{
+	return msevi_l15hrit_read_prologue_records( file, MSEVI_L15HRIT_PRO_ALL );
+}
+
+/**
+ * \brief  Read selected records of a SEVIRI L15 HRIT prologue file
+ *
+ * Only the leading bytes of the requested records which are actually
+ * decoded are read from the file, which avoids reading the full ~445 KB
+ * prologue. Records not requested are left zero. If a cache directory
+ * has been set by msevi_l15hrit_set_cache(), the bytes read are stored
+ * there and reused by later calls. They are decoded on each call, so that
+ * cached entries do not depend on the layout of struct msevi_l15_header.
+ *
+ * \param[in]  file   the prologue file, or member of a tar archive
+ * \param[in]  recs   the records to decode, a combination of the
+ *                    MSEVI_L15HRIT_PRO_* flags
+ *
+ * \return     the decoded prologue, or NULL on failure
+ */
+struct msevi_l15_header *msevi_l15hrit_read_prologue_records( char *file, uint32_t recs )
+{
+	int k, cached = 0;
+	uint64_t key = 0;
+	size_t len = 0, pos;
+	struct msevi_l15_header *header = NULL;
+	struct msevi_l15cache_entry e;
+	struct xrit_file *pro;
+	uint8_t *buf = NULL;
 
 	pro = xrit_fopen( file, "rb" );
+	if( pro==NULL ) pro = xrit_mopen( file );
+	if( pro==NULL ) {
+		fprintf( stderr, "ERROR: unable to open %s\n", file );
+		return NULL;
+	}
 	if( pro->ftype!=MSEVI_L15HRIT_PROLOGUE ) {
 		fprintf( stderr, "ERROR: %s not a SEVIRI prologue file\n", file );
 		goto err_out;
 	}
 
-	/* work-around for broken EUMETSAT archive HRITs */
-	if( ((int)pro->data_len)==0 ){
-		file_size(file, &nbyte);
-		nbyte = nbyte - pro->header_len;
-		pro->data_len = nbyte*8;
-		printf("Fixing prologue len: %d\n", pro->data_len);
+	/* the used bytes of the requested records, one after the other */
+	for( k=0; k<8; k++ ) {
+		if( (recs & (1<<k)) && header_rec_decode[k]!=NULL ) len += header_rec_used[k];
 	}
-
-	data = xrit_read_data( pro );
-	if(data==NULL) goto err_out;
-
-	// printf("Satellite status rec\n");
-	{  /* get satellite status record */
-		{ /* get satellite definition */
-			struct _satellite_definition *sd =
-				&header->satellite_status.satellite_definition;
-			rec_ptr = data+header_rec_off[1];
-
-			memcpy_be16toh( &sd->satellite_id, rec_ptr, 1 );
-			memcpy_be32toh( &sd->nominal_longitude, rec_ptr+2, 1 );
-			memcpy( &sd->satellite_status, rec_ptr+6, 1 );
-		}
-		{ /* get satellite orbit */
-			struct _orbit *orb = &header->satellite_status.orbit;
-			rec_ptr = data+header_rec_off[1]+7+28;
-			memcpy_be16toh( &orb->period_start_time.days,  rec_ptr,   1 );
-			memcpy_be32toh( &orb->period_start_time.msec,  rec_ptr+2, 1 );
-			memcpy_be16toh( &orb->period_end_time.days,    rec_ptr+6, 1 );
-			memcpy_be32toh( &orb->period_end_time.msec,    rec_ptr+8, 1 );
-
-			rec_ptr = data+header_rec_off[1]+7+28+12;
-			for( i=0; i<100; i++ ){
-				memcpy_be16toh( &orb->orbitcoef[i].start_time.days,  rec_ptr, 1);
-				memcpy_be32toh( &orb->orbitcoef[i].start_time.msec, rec_ptr+2, 1);
-				memcpy_be16toh( &orb->orbitcoef[i].end_time.days,  rec_ptr+6, 1);
-				memcpy_be32toh( &orb->orbitcoef[i].end_time.msec, rec_ptr+8, 1);
-				for( j=0; j<8; j++ ){
-					memcpy_be64toh( &orb->orbitcoef[i].x,  rec_ptr+ 12, 8 );
-					memcpy_be64toh( &orb->orbitcoef[i].y,  rec_ptr+ 76, 8 );
-					memcpy_be64toh( &orb->orbitcoef[i].z,  rec_ptr+140, 8 );
-					memcpy_be64toh( &orb->orbitcoef[i].vx, rec_ptr+204, 8 );
-					memcpy_be64toh( &orb->orbitcoef[i].vy, rec_ptr+268, 8 );
-					memcpy_be64toh( &orb->orbitcoef[i].vz, rec_ptr+332, 8 );
-				}
-				rec_ptr += 396;
-			}
-		}
+	header = calloc( 1, sizeof(*header) );
+	buf    = malloc( len>0 ? len : 1 );
+	if( header==NULL || buf==NULL ) {
+		fprintf( stderr, "ERROR: unable to allocate memory for prologue %s\n", file );
+		goto err_out;
 	}
 
-	{ /* get image acquisition record */
-		{ /* planned acquisition time */
-			struct _planned_acquisition_time *pat =
-				&header->image_acquisition.planned_acquisition_time;
-
-			rec_ptr = data + header_rec_off[2];
-			memcpy_be16toh( &pat->true_repeat_cycle_start.days,  rec_ptr+0, 1);
-			memcpy_be32toh( &pat->true_repeat_cycle_start.msec, rec_ptr+2, 1);
-			memcpy_be16toh( &pat->planned_fwd_scan_end.days,  rec_ptr+10, 1);
-			memcpy_be32toh( &pat->planned_fwd_scan_end.msec, rec_ptr+12, 1);
-			memcpy_be16toh( &pat->planned_repeat_cylce_end.days,  rec_ptr+20, 1);
-			memcpy_be32toh( &pat->planned_repeat_cylce_end.msec, rec_ptr+22, 1);
-		}
-	}
-
-	{ /* get image description record */
-		{  /* type of projection */
-			struct _projection_description *pd =
-				&header->image_description.projection_description;
-
-			rec_ptr = data+header_rec_off[4];
-			memcpy( &pd->type_of_projection, rec_ptr, 1 );
-			memcpy_be32toh( &pd->longitude_of_ssp, rec_ptr+1, 1);
-		} { /* reference grid */
-
-			struct _reference_grid *rg =
-				&header->image_description.reference_grid_vis_ir;
-			rec_ptr = data+header_rec_off[4]+5;
-
-			memcpy_be32toh( &rg->number_of_lines, rec_ptr, 1 );
-			memcpy_be32toh( &rg->number_of_columns, rec_ptr+4, 1 );
-			memcpy_be32toh( &rg->line_dir_grid_step, rec_ptr+8, 1 );
-			memcpy_be32toh( &rg->column_dir_grid_step, rec_ptr+12, 1 );
-			memcpy( &rg->grid_origin, rec_ptr+16, 1 );
-			/* printf("nlin=%d ncol=%d lstep=%f cstep=%f origin=%d\n",
-			       rg->number_of_lines, rg->number_of_columns,
-			       rg->line_dir_grid_step,  rg->column_dir_grid_step,
-			       rg->grid_origin ); */
-
-			rg = &header->image_description.reference_grid_hrv;
-			rec_ptr = data+header_rec_off[4]+22;
-
-			memcpy_be32toh( &rg->number_of_lines, rec_ptr, 1 );
-			memcpy_be32toh( &rg->number_of_columns, rec_ptr+4, 1 );
-			memcpy_be32toh( &rg->line_dir_grid_step, rec_ptr+8, 1 );
-			memcpy_be32toh( &rg->column_dir_grid_step, rec_ptr+12, 1 );
-			memcpy( &rg->grid_origin, rec_ptr+16, 1 );
-			/* printf("nlin=%d ncol=%d lstep=%f cstep=%f origin=%d\n",
-			       rg->number_of_lines, rg->number_of_columns,
-			       rg->line_dir_grid_step,  rg->column_dir_grid_step,
-			       rg->grid_origin ); */
-		} { /* planned coverage */
-			struct msevi_l15_coverage *cov;
-
-			/* planned VIS/IR coverage */
-			cov = &header->image_description.planned_coverage_vis_ir;
-			rec_ptr = data+header_rec_off[4]+39;
-			memcpy_be32toh( &cov->southern_line, rec_ptr, 1 );
-			memcpy_be32toh( &cov->northern_line, rec_ptr+4, 1 );
-			memcpy_be32toh( &cov->eastern_column, rec_ptr+8, 1 );
-			memcpy_be32toh( &cov->western_column, rec_ptr+12, 1 );
-			printf("VISIR coverage: %d %d %d %d\n", cov->southern_line,cov->northern_line,cov->eastern_column,cov->western_column);
-
-			/* planned lower HRV coverage */
-			cov =  &header->image_description.planned_coverage_hrv_lower;
-			rec_ptr = data+header_rec_off[4]+55;
-			memcpy_be32toh( &cov->southern_line, rec_ptr, 1 );
-			memcpy_be32toh( &cov->northern_line, rec_ptr+4, 1 );
-			memcpy_be32toh( &cov->eastern_column, rec_ptr+8, 1 );
-			memcpy_be32toh( &cov->western_column, rec_ptr+12, 1 );
-
-			/* planned upper HRV coverage */
-			cov =  &header->image_description.planned_coverage_hrv_upper;
-			rec_ptr = data+header_rec_off[4]+71;
-			memcpy_be32toh( &cov->southern_line, rec_ptr, 1 );
-			memcpy_be32toh( &cov->northern_line, rec_ptr+4, 1 );
-			memcpy_be32toh( &cov->eastern_column, rec_ptr+8, 1 );
-			memcpy_be32toh( &cov->western_column, rec_ptr+12, 1 );
-		} { /* l15 image production */
-			struct _l15_image_production *ip = &header->image_description.l15_image_production;
-			rec_ptr = data+header_rec_off[4]+87;
-			memcpy( &ip->image_proc_direction, rec_ptr, 1 );
-			memcpy( &ip->pixel_gen_direction, rec_ptr+1, 1 );
-			memcpy( &ip->planned_chan_processing, rec_ptr+2, 12 );
-		}
-	}
-
-	{ /* get radiometeric_processing record */
-		{ /* L15 image calibration */
-			struct _l15_image_calibration *cal = header->radiometric_processing.l15_image_calibration;
-			rec_ptr = data+header_rec_off[5]+72;
-
-			for( i=0; i<MSEVI_NCHAN; i++ ) {
-				memcpy_be64toh(&cal->cal_slope, rec_ptr+(2*i)*sizeof(double), 1);
-				memcpy_be64toh(&cal->cal_offset, rec_ptr+(2*i+1)*sizeof(double), 1);
-				cal++;
-			}
+	if( cache_dir!=NULL ) {
+		key = msevi_l15cache_key( file, &recs, sizeof(recs), pro->data_len );
+		if( msevi_l15cache_get_data(cache_dir, key, MSEVI_L15CACHE_PROLOGUE,
+					    len, &e)==0 ) {
+			memcpy( buf, e.data, len );
+			msevi_l15cache_release( &e );
+			cached = 1;
 		}
 	}
 
-	{ /* get geometric processing record */
-		{ /* Optical Axis Distance */
-			int i;
-			struct _opt_axis_distance *oad = &header->geometric_processing.opt_axis_distance;
-			rec_ptr = data+header_rec_off[6];
-			for( i=0; i<MSEVI_NR_CHAN; i++ ) memcpy_be32toh(oad->ew_focal_plane+i, rec_ptr+i*sizeof(float), 1);
-			for( i=0; i<MSEVI_NR_CHAN; i++ ) memcpy_be32toh(oad->ns_focal_plane+i, rec_ptr+(42+i)*sizeof(float), 1);
-		}
-		{ /* Earth model */
-			struct _earth_model *em= &header->geometric_processing.earth_model;
-			rec_ptr = data+header_rec_off[6]+42*2*sizeof(float);
-			memcpy( &em->type, rec_ptr, 1 );
-			memcpy_be64toh( &em->equatorial_radius, rec_ptr+1, 1);
-			memcpy_be64toh( &em->north_polar_radius, rec_ptr+9, 1);
-			memcpy_be64toh( &em->south_polar_radius, rec_ptr+17, 1);
+	for( k=0, pos=0; k<8; k++ ) {
+		if( !(recs & (1<<k)) || header_rec_decode[k]==NULL ) continue;
+		if( !cached && xrit_pread_data(pro, buf+pos, header_rec_used[k],
+					       header_rec_off[k])<0 ) {
+			fprintf( stderr, "ERROR: unable to read prologue %s\n", file );
+			goto err_out;
 		}
+		header_rec_decode[k]( header, buf+pos );
+		pos += header_rec_used[k];
 	}
 	xrit_fclose( pro );
-	free( data );
+
+	if( cache_dir!=NULL && !cached )
+		msevi_l15cache_put_data( cache_dir, cache_max_size, key,
+					 MSEVI_L15CACHE_PROLOGUE, buf, len );
+	free( buf );
 	return header;
 
 err_out:
+	free( buf );
+	free( header );
+	xrit_fclose( pro );
 	return NULL;
 }
 
-struct msevi_l15_trailer *msevi_l15hrit_read_epilogue( char *file )
+/**
+ * \brief  Decode a SEVIRI L15 HRIT prologue
+ *
+ * \param[in]  pro    the prologue, opened by xrit_mopen() or xrit_open_mem()
+ *
+ * \return     the decoded prologue, or NULL on failure
+ */
+struct msevi_l15_header *msevi_l15hrit_decode_prologue( struct xrit_file *pro )
 {
-	struct msevi_l15_trailer *trailer;
-	struct xrit_file *epi = NULL;
-	void *data = NULL;
-	void *rec_ptr;
-	off_t nbyte;
+	int k;
+	struct msevi_l15_header *header;
+	void *data;
 
 	/* allocate structure */
-	trailer = calloc(1,sizeof(*trailer));
-	if( trailer==NULL ) goto err_out;
+	header = calloc( 1, sizeof(*header) );
+	if( header==NULL ) goto err_out;
 
-	epi = xrit_fopen( file, "rb" );
-	if( epi==NULL || epi->ftype != MSEVI_L15HRIT_EPILOGUE ) {
-		fprintf( stderr, "ERROR: %s not a SEVIRI epilogue file\n", file );
-		goto err_out;
-	}
+	if( pro->ftype!=MSEVI_L15HRIT_PROLOGUE ) goto err_out;
 
 	/* work-around for broken EUMETSAT archive HRITs */
-	if( ((int)epi->data_len)==0 ){
-		file_size(file, &nbyte);
-		nbyte = nbyte - epi->header_len;
-		epi->data_len = nbyte*8;
-		printf("Fixing epilogue data_len: %d\n", epi->data_len);
+	if( ((int)pro->data_len)==0 ){
+		pro->data_len = (pro->map_len-pro->header_len)*8;
+		printf("Fixing prologue len: %llu\n", (unsigned long long) pro->data_len);
 	}
 
-	/* read data section */
-	data = xrit_read_data( epi );
+	data = xrit_get_data( pro );
 	if(data==NULL) goto err_out;
 
+	for( k=0; k<8; k++ ) {
+		if( header_rec_decode[k]==NULL ) continue;
+		header_rec_decode[k]( header, data+header_rec_off[k] );
+	}
+	return header;
+
+err_out:
+	free( header );
+	return NULL;
+}
+
+/* decode the version and image production stats of the trailer */
+static void decode_trailer( struct msevi_l15_trailer *trailer, void *data )
+{
+	void *rec_ptr;
+
 	/* get version */
 	rec_ptr = data;
 	memcpy( &trailer->version, rec_ptr, 1);
@@ -735,14 +1885,87 @@ struct msevi_l15_trailer *msevi_l15hrit_read_epilogue( char *file )
 		}
 
 	}
+	return;
+}
+
+/**
+ * \brief  Read a SEVIRI L15 HRIT epilogue file
+ *
+ * Only the version and image production stats records, i.e. the first
+ * 341 bytes of the data field, are read from the file.
+ *
+ * \param[in]  file   the epilogue file, or member of a tar archive
+ *
+ * \return     the decoded epilogue, or NULL on failure
+ */
+struct msevi_l15_trailer *msevi_l15hrit_read_epilogue( char *file )
+{
+	struct msevi_l15_trailer *trailer = NULL;
+	struct xrit_file *epi;
+	uint8_t buf[341];
+
+	epi = xrit_fopen( file, "rb" );
+	if( epi==NULL ) epi = xrit_mopen( file );
+	if( epi==NULL ) {
+		fprintf( stderr, "ERROR: unable to open %s\n", file );
+		return NULL;
+	}
+	if( epi->ftype!=MSEVI_L15HRIT_EPILOGUE ) {
+		fprintf( stderr, "ERROR: %s not a SEVIRI epilogue file\n", file );
+		goto err_out;
+	}
+	if( xrit_pread_data(epi, buf, trailer_rec_off[2], 0)<0 ) {
+		fprintf( stderr, "ERROR: unable to read epilogue %s\n", file );
+		goto err_out;
+	}
 
-	/* cleanup and return */
+	trailer = calloc( 1, sizeof(*trailer) );
+	if( trailer==NULL ) {
+		fprintf( stderr, "ERROR: unable to allocate memory for epilogue %s\n", file );
+		goto err_out;
+	}
+	decode_trailer( trailer, buf );
 	xrit_fclose( epi );
 	return trailer;
 
 err_out:
 	xrit_fclose( epi );
-	free(data);
+	return NULL;
+}
+
+/**
+ * \brief  Decode a SEVIRI L15 HRIT epilogue
+ *
+ * \param[in]  epi    the epilogue, opened by xrit_mopen() or xrit_open_mem()
+ *
+ * \return     the decoded epilogue, or NULL on failure
+ */
+struct msevi_l15_trailer *msevi_l15hrit_decode_epilogue( struct xrit_file *epi )
+{
+	struct msevi_l15_trailer *trailer;
+	void *data = NULL;
+
+	/* allocate structure */
+	trailer = calloc(1,sizeof(*trailer));
+	if( trailer==NULL ) goto err_out;
+
+	if( epi->ftype != MSEVI_L15HRIT_EPILOGUE ) goto err_out;
+
+	/* work-around for broken EUMETSAT archive HRITs */
+	if( ((int)epi->data_len)==0 ){
+		epi->data_len = (epi->map_len-epi->header_len)*8;
+		printf("Fixing epilogue data_len: %llu\n", (unsigned long long) epi->data_len);
+	}
+
+	/* map data section */
+	data = xrit_get_data( epi );
+	if(data==NULL) goto err_out;
+
+	decode_trailer( trailer, data );
+	return trailer;
+
+err_out:
+	free( trailer );
 	return NULL;
 }
 
@@ -830,7 +2053,8 @@ int msevi_l15hrit_annotate_image( struct msevi_l15_image   *img,
 	/* set satellite id constant */
 	img->spacecraft_id = hdr->satellite_status.satellite_definition.satellite_id;
 
-	/* channel attributes */
+	/* channel attributes, if known */
+	if( chaninf==NULL ) return 0;
 	img->f0        = chaninf->f0;
 	img->lambda_c  = chaninf->lambda_c;
 	if( chaninf->nu_c>0.0 ) {
@@ -7,17 +7,35 @@
 #define MSEVI_NCHAN 12
 #define MSEVI_NSEG  24
 
+/* number of columns and column/line offset of the VIS/IR and HRV images */
+#define MSEVI_VISIR_NCOL  3712
+#define MSEVI_VISIR_OFF   1856
+#define MSEVI_HRV_NCOL    5568
+#define MSEVI_HRV_OFF     5566
+
 struct msevi_l15hrit_flist {
  	int  nseg[MSEVI_NCHAN+2];
 	char *prologue;
 	char *epilogue;
 	char *channel[MSEVI_NCHAN+2][MSEVI_NSEG+2];
+	/* segment coverage if known in advance, e.g. from a catalog,
+	   otherwise zero */
+	struct msevi_l15_coverage coverage[MSEVI_NCHAN+2][MSEVI_NSEG+2];
+};
+
+/* information encoded in SEVIRI L15 HRIT file names */
+struct msevi_l15hrit_fname {
+	int    ftype;
+	int    rss;
+	int    channel_id;
+	int    segment;
+	time_t time;
 };
 
 struct msevi_hrec_segment_identification {
 	uint8_t  hrec_type;
 	uint16_t hrec_len;
-	uint8_t  sat_id;
+	uint16_t sat_id;
 	uint8_t  channel_id;
 	uint16_t segm_seq_nr;
 	uint16_t planned_start_segm_seq_nr;
@@ -31,12 +49,70 @@ struct msevi_hrec_segment_line_quality {
 	struct msevi_l15_line_side_info *line_side_info;
 };
 
+/* flags for the header records found by msevi_l15hrit_parse_header */
+#define MSEVI_L15HRIT_HAS_PRIMARY          0x01
+#define MSEVI_L15HRIT_HAS_IMAGE_STRUCTURE  0x02
+#define MSEVI_L15HRIT_HAS_IMAGE_NAVIGATION 0x04
+#define MSEVI_L15HRIT_HAS_SEGMENT_ID       0x08
+#define MSEVI_L15HRIT_HAS_LINE_QUALITY     0x10
+
+/* decoded header records of a SEVIRI L15 HRIT image segment. The line
+   quality entries are left in place, and decoded on demand */
+struct msevi_l15hrit_header {
+	uint32_t found;
+	struct xrit_hrec_primary                 prim;
+	struct xrit_hrec_image_structure         img_struct;
+	struct xrit_hrec_image_navigation        img_nav;
+	struct msevi_hrec_segment_identification seg_id;
+	void     *line_quality;
+	uint32_t nlin_quality;
+};
+
+/* flags for the prologue records decoded by
+   msevi_l15hrit_read_prologue_records */
+#define MSEVI_L15HRIT_PRO_SATELLITE_STATUS       0x02
+#define MSEVI_L15HRIT_PRO_IMAGE_ACQUISITION      0x04
+#define MSEVI_L15HRIT_PRO_IMAGE_DESCRIPTION      0x10
+#define MSEVI_L15HRIT_PRO_RADIOMETRIC_PROCESSING 0x20
+#define MSEVI_L15HRIT_PRO_GEOMETRIC_PROCESSING   0x40
+#define MSEVI_L15HRIT_PRO_ALL                    0x76
+
+struct msevi_l15hrit_segment {
+	char *fnam;
+	struct xrit_file *xf;
+	struct msevi_l15hrit_header hdr;
+	struct msevi_l15_coverage coverage;
+};
+
+int msevi_l15hrit_parse_fname( char *fnam, struct msevi_l15hrit_fname *fn );
 struct msevi_l15hrit_flist* msevi_l15hrit_get_flist(char *dir, time_t *time, char *svc);
 void   msevi_l15hrit_free_flist( struct msevi_l15hrit_flist *fl );
+int    msevi_l15hrit_select_segments( struct msevi_l15hrit_flist *fl, int chan_id,
+				      struct msevi_l15_coverage *cov, char **files );
+
+struct msevi_l15hrit_segment *msevi_l15hrit_open_segment( char *fnam );
+struct msevi_l15hrit_segment *msevi_l15hrit_attach_segment( struct xrit_file *xf );
+void msevi_l15hrit_close_segment( struct msevi_l15hrit_segment *seg );
+struct msevi_l15_image *msevi_l15hrit_decode_segment( struct msevi_l15hrit_segment *seg );
 
 struct msevi_l15_image *msevi_l15hrit_read_image( int nfile, char **files, struct msevi_l15_coverage *cov );
+struct msevi_l15_image *msevi_l15hrit_read_image_scaled( int nfile, char **files,
+							 struct msevi_l15_coverage *cov,
+							 int scale );
+int msevi_l15hrit_read_images( int nfile, char **files, int nimg, struct msevi_l15_coverage *cov,
+			       struct msevi_l15_image **img );
+int msevi_l15hrit_add_segment( struct msevi_l15_image *img, struct msevi_l15hrit_segment *seg );
+int msevi_l15hrit_add_segment_multi( int nimg, struct msevi_l15_image **img,
+				     struct msevi_l15hrit_segment *seg );
+void msevi_l15hrit_set_nthreads( int n );
+void msevi_l15hrit_set_cache( char *dir, size_t max_size );
+void msevi_l15hrit_set_tile_size( int nlin, int ncol );
+void msevi_l15hrit_set_calib( int chan_id, const uint16_t *lut );
 struct msevi_l15_header  *msevi_l15hrit_read_prologue( char *file );
+struct msevi_l15_header  *msevi_l15hrit_read_prologue_records( char *file, uint32_t recs );
 struct msevi_l15_trailer *msevi_l15hrit_read_epilogue( char *file );
+struct msevi_l15_header  *msevi_l15hrit_decode_prologue( struct xrit_file *pro );
+struct msevi_l15_trailer *msevi_l15hrit_decode_epilogue( struct xrit_file *epi );
 int msevi_l15hrit_annotate_image( struct msevi_l15_image   *img,
 				  struct msevi_l15_header  *hdr,
 				  struct msevi_l15_trailer *tra,
@@ -45,3 +121,7 @@ int msevi_l15hrit_annotate_image( struct msevi_l15_image   *img,
 int msevi_l15_fprintf_header( FILE *f, struct msevi_l15_header *hdr );
 int msevi_l15_fprintf_trailer( FILE *f, struct msevi_l15_trailer *tr );
 void *msevi_l15hrit_decode_hrec( void *hrec );
+int msevi_l15hrit_unpack_hrec( void *hrec, struct msevi_hrec_segment_identification *si );
+int msevi_l15hrit_parse_header( void *hdr, size_t len, struct msevi_l15hrit_header *h );
+void msevi_l15hrit_decode_line_quality( struct msevi_l15hrit_header *h, int first, int n,
+					int step, struct msevi_l15_line_side_info *lsi );
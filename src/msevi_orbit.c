@@ -0,0 +1,145 @@
+/**
+ *  \file    msevi_orbit.c
+ *  \brief   Satellite position and velocity from the SEVIRI L15 orbit
+ *           coefficients
+ *
+ *  The prologue holds up to 100 sets of Chebyshev coefficients of the
+ *  satellite position and velocity in the earth-fixed frame, each valid
+ *  for a time interval. For an array of times, e.g. the acquisition times
+ *  of the image lines, consecutive times within the same interval are
+ *  evaluated in blocks, with the recurrence running over all times of a
+ *  block at once so that the compiler can vectorize it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "cds_time.h"
+#include "msevi_l15data.h"
+#include "msevi_orbit.h"
+
+/* number of times evaluated at once */
+#define ORBIT_BLOCK 64
+
+/* seconds from t1 to t2 */
+static inline double diffsec( struct cds_time *t1, struct cds_time *t2 )
+{
+	return 86400.0*(t2->days-t1->days) + ((double)t2->msec-t1->msec)*1e-3;
+}
+
+/* test if the coefficient set is valid at time t */
+static inline int coef_valid( struct _orbitcoef *oc, struct cds_time *t )
+{
+	if( oc->start_time.days==0 && oc->end_time.days==0 ) return 0;
+	return diffsec( &oc->start_time, t )>=0.0 && diffsec( t, &oc->end_time )>=0.0;
+}
+
+/*
+ * Evaluate the Chebyshev series with coefficients c at the n normalized
+ * times xp in [-1,1], i.e. sum_k c[k]*T_k(xp) - c[0]/2, writing the result
+ * to y[0], y[stride], ...
+ */
+static void cheb_eval_block( int n, const double *xp, const double *c,
+			     double *y, int stride )
+{
+	int i, k;
+	double b0[ORBIT_BLOCK], b1[ORBIT_BLOCK], b2[ORBIT_BLOCK];
+
+	for( i=0; i<n; i++ ) {
+		b0[i] = 0.0;
+		b1[i] = 0.0;
+		b2[i] = 0.0;
+	}
+	for( k=MSEVI_ORBIT_NCOEF-1; k>=0; k-- ) {
+		for( i=0; i<n; i++ ) {
+			b2[i] = b1[i];
+			b1[i] = b0[i];
+			b0[i] = 2.0*xp[i]*b1[i] - b2[i] + c[k];
+		}
+	}
+	for( i=0; i<n; i++ ) y[i*stride] = 0.5*(b0[i]-b2[i]);
+	return;
+}
+
+/**
+ * \brief  Find the orbit coefficient set valid at a given time
+ *
+ * \param[in]  orb    the orbit record of the prologue
+ * \param[in]  t      the time
+ *
+ * \return     the index of the coefficient set, or -1 if none is valid
+ */
+int msevi_orbit_find( struct _orbit *orb, struct cds_time *t )
+{
+	int i;
+
+	if( t->days==0 ) return -1;
+	for( i=0; i<100; i++ ) {
+		if( coef_valid( orb->orbitcoef+i, t ) ) return i;
+	}
+	return -1;
+}
+
+/**
+ * \brief  Evaluate the satellite position and velocity at an array of times
+ *
+ * The position and velocity are given in the earth-fixed frame, in km and
+ * km/s. Times without valid coefficient set, e.g. the zero acquisition
+ * time of missing image lines, are set to NaN.
+ *
+ * \param[in]  orb    the orbit record of the prologue
+ * \param[in]  n      the number of times
+ * \param[in]  t      the times, preferably in ascending order
+ * \param[out] pos    the positions x, y, z for each time, i.e. 3*n values,
+ *                    or NULL
+ * \param[out] vel    the velocities vx, vy, vz for each time, i.e. 3*n
+ *                    values, or NULL
+ *
+ * \return     the number of times with valid coefficient set
+ */
+int msevi_orbit_eval( struct _orbit *orb, int n, struct cds_time *t,
+		      double *pos, double *vel )
+{
+	int i, j, m, k, iorb = -1, nvalid = 0;
+	double xp[ORBIT_BLOCK], span;
+	struct _orbitcoef *oc;
+
+	for( i=0; i<n; i+=m ) {
+		/* coefficient set of the first time of the block, re-using that
+		   of the previous block if still valid */
+		if( iorb<0 || !coef_valid( orb->orbitcoef+iorb, t+i ) )
+			iorb = msevi_orbit_find( orb, t+i );
+		if( iorb<0 ) {
+			for( k=0; k<3; k++ ) {
+				if( pos ) pos[3*i+k] = NAN;
+				if( vel ) vel[3*i+k] = NAN;
+			}
+			m = 1;
+			continue;
+		}
+
+		/* normalized times of the following times within the
+		   interval of the coefficient set */
+		oc   = orb->orbitcoef+iorb;
+		span = diffsec( &oc->start_time, &oc->end_time );
+		for( m=0, j=i; j<n && m<ORBIT_BLOCK && coef_valid( oc, t+j ); m++, j++ ) {
+			xp[m] = 2.0*diffsec( &oc->start_time, t+j )/span - 1.0;
+		}
+
+		if( pos ) {
+			cheb_eval_block( m, xp, oc->x, pos+3*i,   3 );
+			cheb_eval_block( m, xp, oc->y, pos+3*i+1, 3 );
+			cheb_eval_block( m, xp, oc->z, pos+3*i+2, 3 );
+		}
+		if( vel ) {
+			cheb_eval_block( m, xp, oc->vx, vel+3*i,   3 );
+			cheb_eval_block( m, xp, oc->vy, vel+3*i+1, 3 );
+			cheb_eval_block( m, xp, oc->vz, vel+3*i+2, 3 );
+		}
+		nvalid += m;
+	}
+	return nvalid;
+}
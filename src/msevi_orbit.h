@@ -0,0 +1,19 @@
+#ifndef _MSEVI_ORBIT_H_
+#define _MSEVI_ORBIT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* number of Chebyshev coefficients of each orbit coefficient set */
+#define MSEVI_ORBIT_NCOEF  8
+
+int msevi_orbit_find( struct _orbit *orb, struct cds_time *t );
+int msevi_orbit_eval( struct _orbit *orb, int n, struct cds_time *t,
+		      double *pos, double *vel );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MSEVI_ORBIT_H_ */
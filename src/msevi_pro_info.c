@@ -22,32 +22,19 @@
 #include "cds_time.h"
 #include "msevi_l15data.h"
 #include "msevi_l15hrit.h"
+#include "msevi_orbit.h"
 #include "eumwavelet.h"
 
 
-double cheb_eval( double x, int n, double *c, double a, double b )
-{
-	double xp, xp2, y;
-	double b0=0.0, b1=0.0, b2=0.0;
-
-	xp  = (2.0*x-a-b)/(b-a); 	/* map interval [a,b] to [-1,1] */
-	xp2 = 2.0*xp;
-
-	for( int i=0; i<n; i++ ){
-		b2 = b1;
-		b1 = b0;
-		b0 = xp2*b1-b2+c[n-1-i];
-	}
-	return (b0-b2)*0.5;
-}
-
 int main( int argc, char **argv )
 {
 	int i, iorb;
 	struct msevi_l15_header  *hdr;
 	struct msevi_l15_trailer *tra;
-	time_t tstart, tend, teval;
+	time_t tstart, tend;
 	time_t tscan;
+	struct cds_time tscan_cds;
+	double pos[3];
 	char *tfmt = "%Y-%m-%dT%H:%M:%SZ", tstr[32];
 
 	/* read pro/epilogue */
@@ -71,15 +58,9 @@ int main( int argc, char **argv )
 		       hdr->radiometric_processing.l15_image_calibration[i].cal_offset );
 	}
 
-	for( i=0; i<100; i++ ) {
-		tstart = time_cds2unix( &hdr->satellite_status.orbit.orbitcoef[i].start_time );
-		tend = time_cds2unix( &hdr->satellite_status.orbit.orbitcoef[i].end_time );
-		if( (tscan>=tstart) && (tscan<tend) ){
-			iorb=i;
-			break;
-		}
-
-	}
+	time_unix2cds( tscan, &tscan_cds );
+	iorb = msevi_orbit_find( &hdr->satellite_status.orbit, &tscan_cds );
+	if( iorb<0 ) goto err_out;
 	tstart = time_cds2unix( &hdr->satellite_status.orbit.period_start_time );
 	tend   = time_cds2unix( &hdr->satellite_status.orbit.period_end_time );
 	strftime( tstr, 32, tfmt, gmtime(&tstart) );
@@ -94,26 +75,8 @@ int main( int argc, char **argv )
 	strftime( tstr, 32, tfmt, gmtime(&tend) );
 	printf( "orbit_end=%s\n", tstr );
 
-	printf( "x=%.3f ", cheb_eval((double) tscan, 8, hdr->satellite_status.orbit.orbitcoef[iorb].x, (double)tstart, (double)tend ));
-	printf( "y=%.3f ", cheb_eval((double) tscan, 8, hdr->satellite_status.orbit.orbitcoef[iorb].y, (double)tstart, (double)tend ));
-	printf( "z=%.3f\n", cheb_eval((double) tscan, 8, hdr->satellite_status.orbit.orbitcoef[iorb].z, (double)tstart, (double)tend ));
-
-#if 0
-	teval  = time_cds2unix( &hdr->satellite_status.orbit.orbitcoef[iorb].start_time );
-	teval  = time_cds2unix( &hdr->satellite_status.orbit.orbitcoef[iorb].end_time );
-	printf( "x=%.3f", cheb_eval((double) teval, 8, hdr->satellite_status.orbit.orbitcoef[i].x, (double)tstart, (double)tend ));
-	printf( "y=%.3f ", cheb_eval((double) teval, 8, hdr->satellite_status.orbit.orbitcoef[i].y, (double)tstart, (double)tend ));
-	printf( "z=%.3f\n", cheb_eval((double) teval, 8, hdr->satellite_status.orbit.orbitcoef[i].z, (double)tstart, (double)tend ));
-
-	printf( "x=%.3f ", cheb_eval((double) teval, 8, hdr->satellite_status.orbit.orbitcoef[i].x, (double)tstart, (double)tend ));
-	printf( "y=%.3f ", cheb_eval((double) teval,  8, hdr->satellite_status.orbit.orbitcoef[i].y, (double)tstart, (double)tend ));
-	printf( "z=%.3f\n", cheb_eval((double) teval,  8, hdr->satellite_status.orbit.orbitcoef[i].z, (double)tstart, (double)tend ));
-
-	teval  = time_cds2unix( &hdr->satellite_status.orbit.orbitcoef[i+1].start_time );
-	printf( "x=%.3f ", cheb_eval((double) teval, 8, hdr->satellite_status.orbit.orbitcoef[i+1].x, (double)tstart, (double)tend ));
-	printf( "y=%.3f ", cheb_eval((double) teval, 8, hdr->satellite_status.orbit.orbitcoef[i+1].y, (double)tstart, (double)tend ));
-	printf( "z=%.3f\n", cheb_eval((double) tstart, 8, hdr->satellite_status.orbit.orbitcoef[i+1].z, (double)tstart, (double)tend ));
-#endif
+	msevi_orbit_eval( &hdr->satellite_status.orbit, 1, &tscan_cds, pos, NULL );
+	printf( "x=%.3f y=%.3f z=%.3f\n", pos[0], pos[1], pos[2] );
 
 	/* cleanup */
 	free(hdr);
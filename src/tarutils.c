@@ -0,0 +1,249 @@
+/**
+    \file    tarutils.c
+    \brief   Utility functions for indexing uncompressed tar archives
+
+    Only the member headers of the archive are read, so that the data of
+    the members can afterwards be accessed in place, e.g. by mapping the
+    byte range of a member from the archive. POSIX ustar and GNU archives
+    are supported, including GNU long names. Compressed archives are not
+    supported.
+*/
+
+/* include system headers */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* include project headers */
+#include "tarutils.h"
+
+#define TAR_BLOCK  512
+
+/* parse an octal header field, or a GNU base-256 number */
+static off_t parse_octal( const char *p, size_t n )
+{
+	size_t i;
+	off_t  v = 0;
+
+	if( (unsigned char)p[0]&0x80 ) {
+		for( i=1; i<n; i++ ) v = (v<<8) | (unsigned char)p[i];
+		return v;
+	}
+	for( i=0; i<n && (p[i]==' ' || p[i]=='\0'); i++ );
+	for( ; i<n && p[i]>='0' && p[i]<='7'; i++ ) v = (v<<3) + (p[i]-'0');
+	return v;
+}
+
+/* check the header checksum of a tar block */
+static int check_header( const unsigned char *blk )
+{
+	int i;
+	unsigned long sum = 0;
+
+	for( i=0; i<TAR_BLOCK; i++ ) {
+		sum += (i>=148 && i<156) ? ' ' : blk[i];
+	}
+	return ( sum==(unsigned long)parse_octal((const char *)blk+148, 8) ) ? 0 : -1;
+}
+
+static int member_cmp( const void *p1, const void *p2 )
+{
+	const struct tar_member *m1 = p1, *m2 = p2;
+	return strcmp( m1->name, m2->name );
+}
+
+/**
+ * \brief check whether a file is a tar archive
+ *
+ * \param[in]  path    the path pointing to the file
+ *
+ * \return 1 if the file is a regular file with a valid tar header,
+ *         otherwise 0
+ */
+int is_tar_file (const char *path)
+{
+	int fd, r = 0;
+	unsigned char blk[TAR_BLOCK];
+
+	fd = open( path, O_RDONLY );
+	if( fd<0 ) return 0;
+	if( pread(fd, blk, TAR_BLOCK, 0)==TAR_BLOCK && check_header(blk)==0 ) r = 1;
+	close( fd );
+	return r;
+}
+
+/**
+ * \brief split the path of a tar archive member
+ *
+ * Members of a tar archive are addressed like files in a directory, e.g.
+ * "cycle.tar/H-000-MSG...". The archive is the longest leading component of
+ * the path which is a regular file.
+ *
+ * \param[in]  path    the member path
+ * \param[out] tarfile buffer receiving the path of the archive
+ * \param[in]  len     the length of the tarfile buffer
+ * \param[out] member  set to the member name within path
+ *
+ * \return zero on success, otherwise -1
+ */
+int tar_split_path (const char *path, char *tarfile, size_t len, const char **member)
+{
+	const char *p;
+	struct stat st;
+
+	for( p=strchr(path+1, '/'); p!=NULL; p=strchr(p+1, '/') ) {
+		if( p-path>=len ) return -1;
+		memcpy( tarfile, path, p-path );
+		tarfile[p-path] = '\0';
+		if( stat(tarfile, &st)<0 ) return -1;
+		if( S_ISREG(st.st_mode) ) {
+			*member = p+1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * \brief read the index of a tar archive
+ *
+ * Members extending beyond the end of the archive, e.g. of a partially
+ * transferred archive, are left out.
+ *
+ * \param[in]  file    the tar archive
+ *
+ * \return the index, sorted by member name, or NULL on error
+ */
+struct tar_index *tar_index_open (const char *file)
+{
+	int    fd = -1, nalloc = 0;
+	off_t  off = 0, size;
+	unsigned char blk[TAR_BLOCK];
+	char   name[PATH_MAX], *longname = NULL, *nam;
+	struct stat st;
+	struct tar_index  *ti;
+	struct tar_member *m;
+
+	ti = calloc( 1, sizeof(*ti) );
+	if( ti==NULL ) goto err_out;
+	ti->file = strdup( file );
+	if( ti->file==NULL ) goto err_out;
+
+	fd = open( file, O_RDONLY );
+	if( fd<0 ) goto err_out;
+	if( fstat(fd, &st)<0 ) goto err_out;
+	ti->size  = st.st_size;
+	ti->mtime = st.st_mtime;
+
+	while( pread(fd, blk, TAR_BLOCK, off)==TAR_BLOCK ) {
+
+		/* an empty block marks the end of the archive */
+		if( blk[0]=='\0' ) break;
+		if( check_header(blk)<0 ) {
+			fprintf( stderr, "ERROR: corrupt tar header in %s at %lld\n",
+				 file, (long long) off );
+			goto err_out;
+		}
+		size = parse_octal( (char *)blk+124, 12 );
+		off += TAR_BLOCK;
+
+		if( blk[156]=='L' ) {
+			/* GNU long name of the next member */
+			free( longname );
+			longname = calloc( 1, size+1 );
+			if( longname==NULL ) goto err_out;
+			if( pread(fd, longname, size, off)!=size ) goto err_out;
+		} else if( blk[156]=='0' || blk[156]=='\0' ) {
+			if( longname ) {
+				snprintf( name, PATH_MAX, "%s", longname );
+				free( longname );
+				longname = NULL;
+			} else if( memcmp(blk+257, "ustar", 5)==0 && blk[345]!='\0' ) {
+				snprintf( name, PATH_MAX, "%.155s/%.100s", blk+345, blk );
+			} else {
+				snprintf( name, PATH_MAX, "%.100s", blk );
+			}
+			nam = name;
+			while( strncmp(nam, "./", 2)==0 ) nam += 2;
+			if( size>ti->size-off ) {
+				fprintf( stderr, "WARNING: truncated tar member %s in %s\n",
+					 nam, file );
+				break;
+			}
+
+			if( ti->nmemb==nalloc ) {
+				nalloc = (nalloc==0) ? 256 : 2*nalloc;
+				m = realloc( ti->memb, nalloc*sizeof(*m) );
+				if( m==NULL ) goto err_out;
+				ti->memb = m;
+			}
+			m = ti->memb+ti->nmemb;
+			m->name   = strdup( nam );
+			if( m->name==NULL ) goto err_out;
+			m->offset = off;
+			m->size   = size;
+			m->mtime  = parse_octal( (char *)blk+136, 12 );
+			ti->nmemb++;
+		} else {
+			/* skip directories, links and extended headers */
+			free( longname );
+			longname = NULL;
+		}
+		off += (size+TAR_BLOCK-1)/TAR_BLOCK*TAR_BLOCK;
+	}
+	close( fd );
+	free( longname );
+
+	qsort( ti->memb, ti->nmemb, sizeof(*ti->memb), member_cmp );
+	return ti;
+
+err_out:
+	if( fd>=0 ) close( fd );
+	free( longname );
+	tar_index_free( ti );
+	return NULL;
+}
+
+/**
+ * \brief free the index of a tar archive
+ *
+ * \param[in]  ti      the index, may be NULL
+ *
+ * \return nothing
+ */
+void tar_index_free (struct tar_index *ti)
+{
+	int i;
+
+	if( ti ) {
+		for( i=0; i<ti->nmemb; i++ ) free( ti->memb[i].name );
+		free( ti->memb );
+		free( ti->file );
+		free( ti );
+	}
+	return;
+}
+
+/**
+ * \brief find a member of a tar archive
+ *
+ * \param[in]  ti      the index of the archive
+ * \param[in]  name    the member name
+ *
+ * \return the member, or NULL if not found
+ */
+struct tar_member *tar_index_find (struct tar_index *ti, const char *name)
+{
+	struct tar_member key;
+
+	while( strncmp(name, "./", 2)==0 ) name += 2;
+	key.name = (char *) name;
+	return bsearch( &key, ti->memb, ti->nmemb, sizeof(key), member_cmp );
+}
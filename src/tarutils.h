@@ -0,0 +1,49 @@
+/*****************************************************************************/
+/*!
+  \file         tarutils.h
+  \brief        include file for tarutils.c, see that file for details
+*/
+/*****************************************************************************/
+
+#ifndef TARUTILS_H
+#define TARUTILS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***** type definitions ******************************************************/
+
+/* a regular file stored in a tar archive */
+struct tar_member {
+	char   *name;      /* member name, without leading "./" */
+	off_t   offset;    /* offset of the member data in the archive */
+	size_t  size;      /* size of the member data */
+	time_t  mtime;     /* modification time of the member */
+};
+
+/* index of the regular files in a tar archive, sorted by name */
+struct tar_index {
+	char   *file;
+	off_t   size;      /* size and modification time of the archive */
+	time_t  mtime;     /* when indexed */
+	int     nmemb;
+	struct tar_member *memb;
+};
+
+/***** end type definitions **************************************************/
+
+
+/***** function prototypes ***************************************************/
+int is_tar_file (const char *path);
+int tar_split_path (const char *path, char *tarfile, size_t len, const char **member);
+struct tar_index *tar_index_open (const char *file);
+void tar_index_free (struct tar_index *ti);
+struct tar_member *tar_index_find (struct tar_index *ti, const char *name);
+/***** end function prototypes ***********************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* tarutils.h */